@@ -1,104 +1,321 @@
 #include <Arduino.h>
 #include <Wire.h>
+#include <util/atomic.h>
+#include <EncoderProtocol.h>
+#include <FastPin.h>
+
+// IR pins
+const byte ir_out = 3, ir_vcc = 5, ir_gnd = 4;
+// The sensor is powered from ir_vcc; switched in the I2C interrupt with a single instruction
+typedef FastPin<ir_vcc> IrPower;
+
+/*
+ * Second channel (build flag CHANNEL_B, set in platformio.ini).
+ * A second IR sensor on pin 2, a quarter slot out of phase with the first one and powered from the same pins.
+ * Its edges are counted too, which doubles the resolution, and the phase between the channels gives the direction.
+ */
+#ifdef CHANNEL_B
+const byte ir_b_out = 2;
+const byte channels = 2;
+#else
+const byte channels = 1;
+#endif
+
+/*
+ * Odometry in fixed point.
+ * Wheel circumference is pi * 70 mm = 219911 um, with 8 ticks per rotation per channel.
+ */
+const unsigned long umPerTick = 219911UL / (8 * channels);
+// Distance of a tick in mm * 16, in Q8; the distance overflows after about 1 km
+const unsigned long mm16PerTickQ8 = 219911UL * 16 * 256 / 1000 / (8 * channels);
+
+// Edges closer than this to the previous edge of the same channel are glitches (us)
+// A full speed wheel gives an edge every few ms; set by the CONFIG command
+volatile uint16_t minTickInterval = 1000;
+
+// Velocity window; the velocity is measured over the edges of the last velocityWindow ms; set by the CONFIG command
+uint16_t velocityWindow = 100;
+
+// Velocity is 0 if no edge is seen for this long (us)
+const unsigned long stallTime = 250000;
+
+// Time between two samples built by loop() (us)
+const unsigned long sampleInterval = 1000;
 
 /**
- * Structure stores the distance travelled by the bot.
- * Using a union since Wire library doesn't allow writing float values.
- * The float value is calculated, and the equivalent character bytes are sent to Master.
+ * State of an encoder channel, used by the glitch filter.
+ * Edges are only accepted if the level differs from the last accepted level, and the interval has passed.
+ * A glitch (a short pulse) may shift the count by one until the next edge, but is never counted twice.
  */
-union Distance {
-  float value;
-  char bytes[sizeof(float)];
+struct Channel {
+  byte level; // Last accepted level
+  unsigned long lastTick; // Time of the last accepted edge (us)
 };
+volatile Channel channel[channels];
 
-// IR pins
-const byte ir_out = 3, ir_vcc = 5, ir_gnd = 4;
+// Direction of the last accepted edge; 1 forward, -1 backward, 0 unknown (single channel)
+volatile int8_t direction = 0;
 
-// Values read by the sensor
-byte oldVal, newVal;
+// Times of the last accepted edges (us); the time of tick n is at n % EDGES, and of tick 0 is the start
+const byte EDGES = 8;
+volatile unsigned long edgeTime[EDGES];
 
-// Ecoder signal
-// Determines whether to start the encoder or not.
-bool startEncoder = false;
+// Encoder is counting
+bool running = false;
+// Edges were rejected since the last sample
+volatile bool glitch = false;
+
+/*
+ * Replies are built by loop(), and the request handler only copies them.
+ * Samples are double buffered: loop() fills the back buffer and then flips front, so a reply is never half built.
+ */
+EncoderProtocol::Status samples[2];
+volatile byte front = 0;
+// Sequence number of the next sample
+uint8_t seq = 0;
+unsigned long lastSample;
+
+// LATCH command: tick count and time captured by the command, and the snapshot built from them by loop()
+volatile bool latchPending = false, latched = false;
+volatile unsigned long latchTicks, latchTime;
+EncoderProtocol::Status snapshot;
 
 /**
  * Variable stores the number of times encoder was triggered
  * unsigned - only counts in non-negative
  * long - possibly a large value
+ * Updated in the interrupts; read in atomic sections
+ */
+volatile unsigned long ticks;
+
+/**
+ * Accepts an edge of a channel if it passes the glitch filter.
+ *
+ * @param c Channel index
+ * @param level Level after the edge
+ * @return true if the edge is counted
  */
-unsigned long ticks;
+bool acceptEdge(byte c, byte level) {
+  unsigned long now = micros();
+  if (level == channel[c].level) return false;
+  if (now - channel[c].lastTick < minTickInterval) {
+    glitch = true;
+    return false;
+  }
+  channel[c].level = level;
+  channel[c].lastTick = now;
+  ticks++;
+  edgeTime[ticks % EDGES] = now;
+  return true;
+}
+
+// Interrupt on every edge of the first channel
+void tickA() {
+  byte a = digitalRead(ir_out);
+  if (!acceptEdge(0, a)) return;
+#ifdef CHANNEL_B
+  // A leads B when moving forward
+  direction = (a != channel[1].level) ? 1 : -1;
+#endif
+}
+
+#ifdef CHANNEL_B
+// Interrupt on every edge of the second channel
+void tickB() {
+  byte b = digitalRead(ir_b_out);
+  if (!acceptEdge(1, b)) return;
+  direction = (b == channel[0].level) ? 1 : -1;
+}
+#endif
+
+/**
+ * Measures the velocity over the edges of the velocity window.
+ * The span is timed with the edge timestamps, so the result doesn't depend on when it's computed.
+ * When the wheel slows down, the time since the last edge is included, so the velocity decays without new edges.
+ *
+ * @param count Tick count
+ * @param times Copy of edgeTime
+ * @param now Current time (us)
+ * @return Speed (mm/s)
+ */
+unsigned long measureVelocity(unsigned long count, const unsigned long times[], unsigned long now) {
+  unsigned long newest = times[count % EDGES];
+  if (!running || count == 0 || now - newest >= stallTime) return 0;
+
+  // Oldest edge within the window; always at least the previous edge (or the start)
+  unsigned long window = velocityWindow * 1000UL;
+  byte edges = 1;
+  while (edges < EDGES - 1 && edges < count && newest - times[(count - edges - 1) % EDGES] <= window) edges++;
+  unsigned long oldest = times[(count - edges) % EDGES];
+
+  // Slower than the last estimate; count the time since the last edge
+  unsigned long span = newest - oldest;
+  if (now - newest > span / edges) span = now - oldest;
+  if (!span) return 0;
+  return edges * umPerTick * 1000UL / span;
+}
+
+/**
+ * Builds a status in the given buffer, with the next sequence number and the CRC.
+ *
+ * @param status Buffer
+ * @param count Tick count
+ * @param now Time of the sample (us)
+ * @param times Copy of edgeTime
+ * @param dir Direction
+ * @param flags Extra flags
+ */
+void build(EncoderProtocol::Status &status, unsigned long count, unsigned long now,
+    const unsigned long times[], int8_t dir, byte flags) {
+  status.version = EncoderProtocol::VERSION;
+  status.seq = seq++;
+  status.flags = flags;
+  if (running) status.flags |= EncoderProtocol::RUNNING;
+  if (dir) status.flags |= EncoderProtocol::DIRECTION;
+  if (dir < 0) status.flags |= EncoderProtocol::REVERSE;
+  status.ticks = count;
+  status.distance = (count * mm16PerTickQ8) >> 8;
+  status.timestamp = now;
+
+  long velocity = measureVelocity(count, times, now);
+  if (velocity > 0x7FFF) velocity = 0x7FFF;
+  status.velocity = (dir < 0) ? -velocity : velocity;
+  EncoderProtocol::seal(status);
+}
+
+// Builds the next sample, and the snapshot of a LATCH command
+// Everything is read in one atomic section, so the values are consistent with each other
+void sample() {
+  unsigned long count, now, times[EDGES], latchCount = 0, latchAt = 0;
+  int8_t dir;
+  bool rejected, latch;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = ticks;
+    now = micros();
+    for (byte i = 0; i < EDGES; i++) times[i] = edgeTime[i];
+    dir = direction;
+    rejected = glitch;
+    glitch = false;
+    latch = latchPending;
+    if (latch) {
+      latchCount = latchTicks;
+      latchAt = latchTime;
+    }
+  }
+
+  byte flags = rejected ? EncoderProtocol::GLITCH : 0;
+  build(samples[!front], count, now, times, dir, flags);
+  front = !front;
+
+  if (latch) {
+    build(snapshot, latchCount, latchAt, times, dir, flags | EncoderProtocol::LATCHED);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      latchPending = false;
+      latched = true;
+    }
+  }
+}
 
 /**
  * Invoked when Slave recives instruction from Master.
- * Based on the code recieved, this method either starts or stops the encoder.
- * Encoder starts when code is 1, and stops when code is 0.
- * The code must be an integer value.
- * 
+ * The first byte is an EncoderProtocol::Command, followed by its payload:
+ *  STOP: stops the encoder and turns off the sensor
+ *  START: turns on the sensor, clears the count and starts the encoder
+ *  RESET: clears the count
+ *  LATCH: captures the count now; the snapshot is sent by the first read after loop() has built it
+ *  CONFIG: sets the glitch filter and velocity window from an EncoderProtocol::Config
+ * Runs in the I2C interrupt, so the interrupts of the encoder can't run halfway.
+ *
  * @param numBytes Number of bytes read from the master
  */
 void receiveEvent(int numBytes) {
   byte code = Wire.read(); // Read code
-  if (code == 1) {
+  if (code == EncoderProtocol::START) {
     // Initialize encoder
-    ticks = 0;
-    startEncoder = true;
     // Turn on the IR sensor
-    digitalWrite(ir_vcc, HIGH);
-    // Read initial value
-    oldVal = digitalRead(ir_out);
-  } else if (code == 0) {
+    IrPower::write(HIGH);
+    ticks = 0;
+    direction = 0;
+    edgeTime[0] = micros();
+    // Read initial values
+    channel[0].level = digitalRead(ir_out);
+    channel[0].lastTick = micros();
+#ifdef CHANNEL_B
+    channel[1].level = digitalRead(ir_b_out);
+    channel[1].lastTick = micros();
+#endif
+    // Count every edge
+    attachInterrupt(digitalPinToInterrupt(ir_out), tickA, CHANGE);
+#ifdef CHANNEL_B
+    attachInterrupt(digitalPinToInterrupt(ir_b_out), tickB, CHANGE);
+#endif
+    running = true;
+  } else if (code == EncoderProtocol::STOP) {
     // Stop encoder
-    startEncoder = false;
+    detachInterrupt(digitalPinToInterrupt(ir_out));
+#ifdef CHANNEL_B
+    detachInterrupt(digitalPinToInterrupt(ir_b_out));
+#endif
     // Turn of IR sensor
-    digitalWrite(ir_vcc, LOW);
+    IrPower::write(LOW);
+    running = false;
+  } else if (code == EncoderProtocol::RESET) {
+    ticks = 0;
+    edgeTime[0] = micros();
+  } else if (code == EncoderProtocol::LATCH) {
+    latchTicks = ticks;
+    latchTime = micros();
+    latchPending = true;
+    latched = false;
+  } else if (code == EncoderProtocol::CONFIG && numBytes > (int) sizeof(EncoderProtocol::Config)) {
+    EncoderProtocol::Config config;
+    Wire.readBytes((uint8_t *) &config, sizeof(config));
+    minTickInterval = config.minTickInterval;
+    velocityWindow = config.velocityWindow;
   }
 }
 
 /**
- * Method calculates distance travelled and sends the data to Master.
- * Invoked when Master requests data from Slave.
- * Distance is calculated using the number of ticks recorded.
+ * Sends the latest status to Master in one burst.
+ * Invoked when Master requests data from Slave. The status is already built, so it's only copied.
  */
-void calcDistace() {
-  Distance dist;
-  float pi = 3.14,
-    diameter = 7, // Diameter of wheel
-    tickRate = 8; // Number of ticks per rotation
-
-  // Rotations made by the wheel
-  float rotations = ticks / tickRate; 
-  dist.value = (pi * diameter) * rotations; // Circumference * Number of rotations
-  Wire.write(dist.bytes);
+void sendStatus() {
+  if (latched) {
+    latched = false;
+    Wire.write((const uint8_t *) &snapshot, sizeof(snapshot));
+  } else Wire.write((const uint8_t *) &samples[front], sizeof(EncoderProtocol::Status));
 }
 
 // Starting point
 void setup() {
   // Set IR pin modes
-  pinMode(ir_vcc, OUTPUT);
+  IrPower::setOutput();
   pinMode(ir_gnd, OUTPUT);
   pinMode(ir_out, INPUT);
+#ifdef CHANNEL_B
+  pinMode(ir_b_out, INPUT);
+#endif
 
   // Always at LOW
   // Only ir_vcc state varies
   digitalWrite(ir_gnd, LOW);
 
+  // First reply
+  sample();
+  lastSample = micros();
+
   // Join I2C bus with address #8
-  Wire.begin(8);
+  Wire.begin(EncoderProtocol::ADDRESS);
 
   // Register events
   Wire.onReceive(receiveEvent);
-  Wire.onRequest(calcDistace);
+  Wire.onRequest(sendStatus);
 }
 
+// Ticks are counted in the interrupts; the replies are built here
 void loop() {
-  // Check whether to start the encoder or not
-  if (startEncoder) {
-    newVal = digitalRead(ir_out); // Read sensor data
-    
-    // Change in state
-    if (newVal != val) {
-      ticks++; // Update tick count
-      oldVal = newVal; // Store value
-    }
+  if (latchPending || micros() - lastSample >= sampleInterval) {
+    lastSample = micros();
+    sample();
   }
 }
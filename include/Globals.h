@@ -4,14 +4,24 @@
 #include <WallDetector.h>
 #include <LineDetector.h>
 #include <Driver.h>
-#include <LiquidCrystal_I2C.h>
+#include <LcdBuffer.h>
+#include <MazeMemory.h>
+
+// Line sensor array; A0-A7 are bits 0-7 of PORTF on the Mega, so the array is read with one port read
+typedef LineDetector<8, A0, A1, A2, A3, A4, A5, A6, A7> LineArray;
+// Trigger pins of the ultrasonic sensors; all on PORTC, so a trigger write is a single instruction
+typedef WallDetector::Triggers<30, 31, 32> SonarTriggers;
+// Motor pins; outputs of Timer3 (left) and Timer4 (right)
+typedef Driver::Wiring<2, 3> LeftMotor;
+typedef Driver::Wiring<6, 7> RightMotor;
 
 class Globals {
 public:
     static WallDetector wall;
-    static LineDetector line;
+    static LineArray line;
     static Driver driver;
-    static LiquidCrystal_I2C lcd;
+    static LcdBuffer lcd;
+    static MazeMemory maze;
 };
 
 #endif
@@ -1,8 +1,18 @@
 #ifndef ZONES_H
 #define ZONES_H
 
+#include <Arduino.h>
+
 /**
- * Procedure to operate bot in section A-B. The zone includes:
+ * The course is run as tasks of the Scheduler (see main.cpp). None of them waits:
+ *  - lineTask() reads the line sensors, and collects the line events
+ *  - controlTask() runs the current zone as a state machine, and drives the bot
+ *  - sonarTask() ranges the walls requested by the zones
+ *  - displayTask() pushes the changed characters to the display
+ * The control task runs the zones in order: maze solving, wall following and distance measuring.
+ * Each zone is a table-driven state machine; the progress is checkpointed in EEPROM, and its transitions are logged.
+ *
+ * Section A-B (maze solving). The zone includes:
  *  - Line following
  *  - Maze solving
  *  - Node detection
@@ -10,37 +20,72 @@
  *  - Wall detection at end
  * Line following is done by using standard weight assignment and PID calculation.
  * Maze solving uses "X hand on the wall" algorithm. X can either be left or right.
- * 
+ *
  * The general approach is to follow steps for solving maze, using principle of line following.
  * Whenever a node is detected increase counter and determine it's time. It should be done independent of maze solving.
  * End of section is reached when bot is on a cross-section and a wall is found on any one side (left or right).
  * If the bot is off line, a wrong turn was taken and the bot is turned around.
- * 
- * @param primarySide Side to be followed in the maze
- * @return Index of the wall at the end.
- */
-short mazeSolving(short);
-
-/**
- * Procedure to operate bot in section B-C and C-D. The zone includes:
+ * Every junction decision is logged in EEPROM by MazeMemory, with dead ends pruned.
+ * A later run (or a retry after a reset) replays the logged path, faster on the straights, and explores only the rest.
+ *
+ * Section B-C and C-D (wall following), starting on the side of the wall found at the end of the maze. The zone includes:
  *  - Wall following
  *  - Wall switching
  *  - Front wall detection (Turn on opposite to primary side)
  *  - Turn on primary side
  * Wall is followed while maintaing an average distance, which acts as the center line between min and max distance.
- *  
- * @param primary Initial side on which wall is present.
- */
-void wallFollowing(byte);
-
-/**
- * Procedure to operate bot in section D-E. The zone includes:
+ *
+ * Section D-E (distance measuring). The zone includes:
  *  - Straight line following
  *  - Node detection
  *  - Measuring distance between two nodes
  * When the first node is detected, the encoder is initialised. It is stopped when the second node is detected.
  * The encoding is done using a secondary controller which acts as slave. Distance is requested once second node is detected.
  */
-void distanceMeasuring();
+
+/**
+ * Starts the course at the maze. The tasks do nothing before.
+ * The line sensors must be calibrated; the calibration is saved with the checkpoint.
+ *
+ * @param primarySide Side to be followed in the maze
+ */
+void startCourse(byte);
+
+/**
+ * Resumes the course from the checkpoint in EEPROM, with the line calibration of the interrupted run.
+ * The zone resumes in a state that doesn't depend on the motion in progress at the reset.
+ * "Resuming" is shown for 2 s first; a reset meanwhile clears the checkpoint, so the course starts over.
+ *
+ * @return false if there is no course to resume; it was never started, it was completed, or it was restarted
+ */
+bool resumeCourse();
+
+/**
+ * Checks whether the whole course is run.
+ *
+ * @return true once the finish is reached and shown, and the checkpoint is written
+ */
+bool courseDone();
+
+/**
+ * Line sensing task. Reads the line sensors; the events are kept until the control task takes them.
+ */
+void lineTask();
+
+/**
+ * Control task. Runs a step of the current zone; ends bounded motions of the driver.
+ * Writes a byte of the checkpoint or the maze log per run, if the EEPROM is ready.
+ */
+void controlTask();
+
+/**
+ * Sonar task. Collects the echoes and fires the ultrasonic sensors requested by the zones.
+ */
+void sonarTask();
+
+/**
+ * Display task. Writes the changed characters of the framebuffer, within a time budget.
+ */
+void displayTask();
 
 #endif
@@ -2,113 +2,295 @@
 #include <Driver.h>
 #include <Wire.h>
 
-// Contructor
-Driver::Driver(byte mPins[][2], byte base) {
-    // Assigning pins
-    mLeft.positive = mPins[0][0];
-    mLeft.negative = mPins[0][1];
-    mRight.positive = mPins[1][0];
-    mRight.negative = mPins[1][1];
-    // Setting pin mode
-    pinMode(mLeft.positive, OUTPUT);
-    pinMode(mLeft.negative, OUTPUT);
-    pinMode(mRight.positive, OUTPUT);
-    pinMode(mRight.negative, OUTPUT);
-
+// Set up the driver
+void Driver::setup(byte base) {
     // Setting base voltage
     baseVolt = base;
 
+    kR = 0;
+    mLeft.target = mLeft.output = mRight.target = mRight.output = 0;
+    setRampTime(RAMP_TIME);
+    ramping = false;
+    motion.state = Motion::IDLE;
+    encoderOn = false;
+    memset(&encoder, 0, sizeof(encoder));
+
     // join I2C bus (address optional for master)
     Wire.begin();
 }
 
+// Start the motor PWM
+void Driver::begin() {
+    mLeft.start();
+    mRight.start();
+    stop();
+}
+
 // Destructor
 Driver::~Driver() {}
 
-// Writes signal to motor
-void Driver::Motor::apply(byte v1, byte v2) {
-    analogWrite(positive, v1);
-    analogWrite(negative, v2);
+// Set base voltage
+void Driver::setBaseVolt(byte base) {
+    baseVolt = base;
+}
+
+// Get base voltage
+byte Driver::getBaseVolt() {
+    return baseVolt;
+}
+
+// Set slew limit
+void Driver::setRampTime(uint16_t ms) {
+    // Counts per us = PWM_TOP / (ms * 1000); at least 2 ms, so that the rate fits
+    if (ms == 1) ms = 2;
+    slewRate = ms ? ((uint32_t) PWM_TOP << SLEW_SHIFT) / (ms * 1000UL) : 0;
+}
+
+// Saturated command voltage
+byte Driver::level(byte volt) {
+    return volt > 255 - baseVolt ? 255 : baseVolt + volt;
+}
+
+// Ramp the motors toward their voltages
+void Driver::slew() {
+    if (mLeft.output == mLeft.target && mRight.output == mRight.target) {
+        ramping = false;
+        return;
+    }
+    if (!slewRate) {
+        // No limit
+        mLeft.ramp(2 * PWM_TOP);
+        mRight.ramp(2 * PWM_TOP);
+        return;
+    }
+
+    unsigned long now = micros();
+    if (!ramping) {
+        // A new ramp; its steps are timed from now, however long the motors have been settled
+        ramping = true;
+        lastSlew = now;
+        slewCredit = 0;
+        return;
+    }
+    unsigned long elapsed = now - lastSlew;
+    lastSlew = now;
+    // Counts earned since the last step; the fraction is kept for the next one
+    slewCredit += (elapsed < MAX_SLEW_INTERVAL ? elapsed : MAX_SLEW_INTERVAL) * slewRate;
+    uint32_t step = slewCredit >> SLEW_SHIFT;
+    if (!step) return;
+    slewCredit -= step << SLEW_SHIFT;
+    if (step > 2 * PWM_TOP) step = 2 * PWM_TOP;
+    mLeft.ramp(step);
+    mRight.ramp(step);
+    if (mLeft.output == mLeft.target && mRight.output == mRight.target) ramping = false;
 }
 
 // Drive bot in desired direction
 void Driver::move(byte direction, byte volt, byte rotate) {
-    // Constant of rotation
-    // Calculated using given volt
-    // Multiplied with the rotation angle to get delay time
-    int kR = 0;
-    
-    if (rotate) stop(); // Stop before rotating
+    if (rotate && (direction == LEFT || direction == RIGHT)) {
+        // Blocking rotation
+        this->rotate(direction, volt, rotate);
+        while (busy()) update();
+    } else drive(direction, volt);
+}
+
+// Start rotation
+void Driver::rotate(byte direction, byte volt, byte angle) {
+    if (direction != LEFT && direction != RIGHT) return;
+    stop(); // Stop before rotating
 
+    // Encoder must be counting
+    if (!encoderOn) initEncoder();
+    long ticks = getTicks();
+
+    motion.state = Motion::ROTATING;
+    motion.start = millis();
+    motion.direction = direction;
+    motion.volt = volt;
+    motion.closedLoop = ticks >= 0;
+
+    if (motion.closedLoop) {
+        // Arc covered by the left wheel; pivot around the right wheel, or spin around the center
+        motion.spin = direction == LEFT;
+        uint32_t radius = motion.spin ? WHEEL_BASE / 2 : WHEEL_BASE;
+        // ticks = radius * angle * (pi / 180) * TICKS_PER_ROTATION / WHEEL_CIRCUMFERENCE; pi / 180 ~ 71 / 4068
+        uint32_t den = (uint32_t) WHEEL_CIRCUMFERENCE * 4068;
+        motion.targetTicks = (radius * angle * TICKS_PER_ROTATION * 71 + den / 2) / den;
+        motion.startTicks = ticks;
+        motion.lastPoll = millis();
+        motion.duration = MAX_TURN_TIME;
+    } else {
+        // Keep one wheel fixed, and rotate for a time proportional to the angle
+        motion.spin = false;
+        motion.duration = (unsigned long) kR * angle;
+    }
+    applyRotation(volt);
+}
+
+// Drive wheels of a rotation
+void Driver::applyRotation(byte volt) {
+    if (motion.direction == LEFT) {
+        // Rotate right wheel forward; left wheel is fixed, or reversed when spinning
+        if (motion.spin) mLeft.apply(0, level(volt));
+        mRight.apply(level(volt), 0);
+    } else {
+        // Keep right wheel fixed, rotate left wheel
+        mLeft.apply(level(volt), 0);
+    }
+    slew();
+}
+
+// Start driving
+void Driver::drive(byte direction, byte volt, unsigned long duration) {
     switch(direction) {
         case FORWARD:
             // Rotate left and right motors in the same direction
-            mLeft.apply(baseVolt + volt, 0);
-            mRight.apply(baseVolt + volt, 0);
+            mLeft.apply(level(volt), 0);
+            mRight.apply(level(volt), 0);
             break;
         case BACKWARD:
             // Rotate motors in same direction, but in reverse
-            mLeft.apply(0, baseVolt + volt);
-            mRight.apply(0, baseVolt + volt);
+            mLeft.apply(0, level(volt));
+            mRight.apply(0, level(volt));
             break;
         case LEFT:
-            if (rotate) {
-                // Keep left wheel fixed, rotate right wheel
-                mRight.apply(baseVolt + volt, 0);
-                delay(kR * rotate);
-                mRight.apply(0, 0); // Stop right wheel
-            } else {
-                // Don't rotate, but slide
-                // Rotate left motor slower than right motor
-                mLeft.apply(baseVolt, 0);
-                mRight.apply(baseVolt + volt, 0);
-            }
+            // Don't rotate, but slide
+            // Rotate left motor slower than right motor
+            mLeft.apply(baseVolt, 0);
+            mRight.apply(level(volt), 0);
             break;
         case RIGHT:
-            if (rotate) {
-                // Keep right wheel fixed, rotate left wheel
-                mLeft.apply(baseVolt + volt, 0);
-                delay(kR * rotate);
-                mLeft.apply(0, 0); // Stop left wheel
-            } else {
-                // Don't rotate, but slide
-                // Rotate left motor faster than right motor
-                mLeft.apply(baseVolt + volt, 0);
-                mRight.apply(baseVolt, 0);
-            }
+            // Don't rotate, but slide
+            // Rotate left motor faster than right motor
+            mLeft.apply(level(volt), 0);
+            mRight.apply(baseVolt, 0);
             break;
+        default:
+            return;
     }
+
+    slew();
+
+    motion.state = Motion::DRIVING;
+    motion.start = millis();
+    motion.duration = duration;
+}
+
+// Advance motion
+void Driver::update() {
+    slew();
+    if (motion.state == Motion::IDLE) return;
+
+    if (motion.state == Motion::ROTATING && motion.closedLoop && millis() - motion.lastPoll >= TURN_POLL_INTERVAL) {
+        motion.lastPoll = millis();
+        long ticks = getTicks();
+        if (ticks >= 0) {
+            unsigned long covered = ticks - motion.startTicks;
+            if (covered >= motion.targetTicks) {
+                stop(); // Target reached
+                return;
+            }
+            // Decelerate near the target
+            if (motion.targetTicks - covered <= SLOW_TICKS && motion.volt) {
+                motion.volt = 0;
+                applyRotation(0);
+            }
+        }
+    }
+
+    // Rotations are always bounded, even when they take no time
+    bool bounded = motion.duration || motion.state == Motion::ROTATING;
+    if (bounded && millis() - motion.start >= motion.duration) stop();
 }
 
-// Stop motors
+// Bounded motion in progress
+bool Driver::busy() {
+    return motion.state == Motion::ROTATING || (motion.state == Motion::DRIVING && motion.duration);
+}
+
+// Pre-empt motion
+void Driver::cancel() {
+    stop();
+}
+
+// Stop motors; rotations end at their target, so a stop isn't ramped
 void Driver::stop() {
-    mLeft.apply(0, 0);
-    mRight.apply(0, 0);
+    mLeft.halt();
+    mRight.halt();
+    ramping = false;
+    motion.state = Motion::IDLE;
+}
+
+// Send command to encoder
+bool Driver::sendEncoder(byte command, const void *payload, byte length) {
+    Wire.beginTransmission(EncoderProtocol::ADDRESS);
+    Wire.write(command);
+    if (length) Wire.write((const uint8_t *) payload, length);
+    return Wire.endTransmission() == 0;
 }
 
 // Start encoding
 void Driver::initEncoder() {
-    Wire.beginTransmission(8);
-    Wire.write(1); // Start encoder
-    Wire.endTransmission();
+    sendEncoder(EncoderProtocol::START);
+    encoderOn = true;
 }
 
 // Stop encoding
 void Driver::stopEncoder() {
-    Wire.beginTransmission(8);
-    Wire.write(0); // Stop encoder
-    Wire.endTransmission();
+    sendEncoder(EncoderProtocol::STOP);
+    encoderOn = false;
+}
+
+// Clear tick count
+void Driver::resetEncoder() {
+    sendEncoder(EncoderProtocol::RESET);
+}
+
+// Snapshot encoder status
+void Driver::latchEncoder() {
+    sendEncoder(EncoderProtocol::LATCH);
+}
+
+// Set glitch filter and velocity window
+void Driver::configureEncoder(uint16_t minTickInterval, uint16_t velocityWindow) {
+    EncoderProtocol::Config config = {minTickInterval, velocityWindow};
+    sendEncoder(EncoderProtocol::CONFIG, &config, sizeof(config));
+}
+
+// Read encoder status
+bool Driver::readEncoder() {
+    union Reply {
+        EncoderProtocol::Status status;
+        char bytes[sizeof(EncoderProtocol::Status)];
+    } reply;
+    short size = sizeof(EncoderProtocol::Status);
+
+    if (Wire.requestFrom((int) EncoderProtocol::ADDRESS, size) != size) return false; // No Slave
+    Wire.readBytes(reply.bytes, size);
+    if (!EncoderProtocol::valid(reply.status)) return false; // Corrupted
+    encoder = reply.status;
+    return true;
+}
+
+// Last encoder status
+const EncoderProtocol::Status &Driver::getEncoderStatus() {
+    return encoder;
+}
+
+// Return tick count
+long Driver::getTicks() {
+    if (!readEncoder()) return -1;
+    return encoder.ticks;
 }
 
 // Return distance travelled
 float Driver::getDistanceTravelled() {
-    short size = sizeof(float);
-    union Distance {
-        float value;
-        char bytes[sizeof(float)];
-    } dist;
-    
-    Wire.requestFrom(8, size);
-    Wire.readBytes(dist.bytes, size); // Read bytes
-    return dist.value; // Return equivalent float value
+    if (!readEncoder()) return 0;
+    return encoder.distance / 160.0; // mm * 16 to cm
+}
+
+// Return speed
+int16_t Driver::getSpeed() {
+    if (!readEncoder()) return 0;
+    return encoder.velocity;
 }
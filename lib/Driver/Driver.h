@@ -1,6 +1,9 @@
 #ifndef DRIVER_H
 #define DRIVER_H
 
+#include <EncoderProtocol.h>
+#include <FastPin.h>
+
 /**
  * The library is repsosible for movement of the bot. 
  * It interacts with the motors and the rotary encoder. It uses them to move the bot in desired direction and calculate the distance travelled.
@@ -9,40 +12,255 @@ class Driver {
 private:
     /**
      * The robot has two motors, the left motor and the right motor.
-     * Each motor has two pins, a positive pin and a negative pin.
+     * Each motor has two PWM pins, a positive pin and a negative pin.
+     * The pins are known at compile time (see Driver::Wiring), so a motor writes the compare registers of its pins directly.
+     * A motor doesn't jump to the voltage it's given: its output follows it at the slew rate (see Driver::slew()).
      */
     struct Motor {
-        // Motor terminals
-        byte positive, negative;
+        // Sets up the timer and pins of the motor; generated for its pins, see Driver::startMotor()
+        void (*start)();
+        // Writes the compare values of both terminals; generated for its pins, see Driver::writeMotor()
+        void (*write)(uint16_t, uint16_t);
+        // Compare value asked for, and the one being output; negative values drive the negative terminal
+        int16_t target, output;
+
         /**
-         * Method writes digital signal to the positive and negative pins of the motor, respectively.
+         * Method sets the PWM signal of the positive and negative pins of the motor, respectively.
          * 
          * @param v1 Value to be written at positive terminal
          * @param v2 Value to be written at negative terminal
          */
-        void apply(byte, byte);
+        void apply(byte v1, byte v2) {
+            target = (int16_t) scale(v1) - (int16_t) scale(v2);
+        }
+
+        /**
+         * Moves the output toward the target, and writes it when it changes.
+         * A reversal ramps down through 0.
+         *
+         * @param step Largest change of the output (compare counts)
+         */
+        void ramp(uint16_t step) {
+            int16_t next = target;
+            if (target > output + (int16_t) step) next = output + step;
+            else if (target < output - (int16_t) step) next = output - step;
+            if (next == output) return;
+            output = next;
+            if (output >= 0) write(output, 0);
+            else write(0, -output);
+        }
+
+        // Stops the motor at once
+        void halt() {
+            target = output = 0;
+            write(0, 0);
+        }
     } mLeft, mRight; // Left and right motors.
 
+    /*
+     * Motor PWM: phase correct on the timers of the motor pins, at the CPU clock with a TOP of PWM_TOP.
+     * 16 MHz / (2 * 400) = 20 kHz; above hearing, and smooth enough for the torque of the motors at low voltage.
+     * Voltages (0 to 255) are scaled to 0 to PWM_TOP by VOLT_SCALE / 256.
+     */
+    const static uint16_t PWM_FREQUENCY = 20000, // Hz
+        PWM_TOP = F_CPU / 2 / PWM_FREQUENCY,
+        VOLT_SCALE = (PWM_TOP * 256UL + 254) / 255;
+
+    /**
+     * Compare value of a voltage.
+     *
+     * @param volt 0 to 255
+     * @return 0 to PWM_TOP
+     */
+    static uint16_t scale(byte volt) {
+        return ((uint32_t) volt * VOLT_SCALE) >> 8;
+    }
+
+    // Sets up the terminals of the motor wired to pins P and N; both pins are on 16 bit timers
+    template<byte P, byte N> static void startMotor() {
+        FastPin<P>::setPwmTop(PWM_TOP);
+        FastPin<N>::setPwmTop(PWM_TOP);
+        FastPin<P>::startPwm();
+        FastPin<N>::startPwm();
+    }
+
+    // Writes the terminals of the motor wired to pins P and N
+    template<byte P, byte N> static void writeMotor(uint16_t v1, uint16_t v2) {
+        FastPin<P>::setCompare(v1);
+        FastPin<N>::setCompare(v2);
+    }
+
+    /**
+     * Sets up everything but the motors; called by the constructor.
+     *
+     * @param base Minimum voltage to be applied
+     */
+    void setup(byte);
+
+    /*
+     * Slew limit of the motors. A step change of voltage makes the wheels slip, which wastes time and
+     * makes the encoder count ticks the bot didn't travel; the outputs are ramped toward the voltages instead.
+     */
+    // Default time of a ramp from 0 to full voltage (ms)
+    const static uint16_t RAMP_TIME = 100;
+    // Longest time between two steps of a ramp taken into account (us)
+    const static uint16_t MAX_SLEW_INTERVAL = 50000;
+    // Fraction bits of slewRate and slewCredit
+    const static byte SLEW_SHIFT = 18;
+    // Compare counts the outputs may change by per us, in 1 / 2^SLEW_SHIFT; 0 for no limit
+    uint16_t slewRate;
+    // Change allowed but not taken yet, in 1 / 2^SLEW_SHIFT count
+    uint32_t slewCredit;
+    // Time of the last step of the ramp (us)
+    unsigned long lastSlew;
+    // A ramp is in progress; its steps are timed from lastSlew
+    bool ramping;
+
+    /**
+     * Steps the outputs of the motors toward their voltages, by as much as the slew rate allows since the last step.
+     */
+    void slew();
+
+    /**
+     * Voltage of a command; the base voltage plus the given one, saturated at full voltage.
+     *
+     * @param volt Voltage added to the base voltage
+     * @return Voltage to be applied
+     */
+    byte level(byte);
+
     // Minimum voltage to be applied to the motors
     byte baseVolt;
 
+    // Constant of rotation; time taken to rotate by a degree (ms)
+    // Only used when the encoder slave doesn't answer
+    // TODO measure at base volt
+    uint16_t kR;
+
+    /*
+     * Geometry of the chassis, used to convert a rotation to encoder ticks.
+     * The encoder is on the left wheel, and counts every edge of both channels of the slotted disc (13.75 mm of travel).
+     * A rotation ends on a whole tick, so it's within half a tick of the angle: about 5 degrees spinning in place,
+     * and 2.6 degrees pivoting on the right wheel.
+     */
+    const static uint16_t WHEEL_BASE = 150, // Distance between the contact points of the driven wheels (mm)
+        WHEEL_CIRCUMFERENCE = 220, // 7 cm wheel (mm)
+        TICKS_PER_ROTATION = 16; // Encoder ticks per rotation of the wheel; the Slave is built with CHANNEL_B
+    // Remaining ticks below which a rotation is slowed down to base volt; about a quarter of a 90 degree spin (9 ticks)
+    const static byte SLOW_TICKS = 2;
+    // Longest time allowed for a rotation with the encoder; guards against a stalled wheel (ms)
+    const static unsigned long MAX_TURN_TIME = 3000;
+    // Shortest time between two encoder reads during a rotation (ms); a read is an 18 byte I2C transaction (~1.5 ms),
+    // which would take most of every control run. Ticks are 27 mm of the wheel apart, tens of ms, so little is overshot
+    const static unsigned long TURN_POLL_INTERVAL = 5;
+
+    // Encoder slave is counting
+    bool encoderOn;
+    // Last valid status read from the encoder slave
+    EncoderProtocol::Status encoder;
+
+    /**
+     * Sends a command to the encoder slave.
+     *
+     * @param command EncoderProtocol::Command
+     * @param payload Bytes following the command (default = none)
+     * @param length Number of payload bytes
+     * @return true if the slave acknowledged
+     */
+    bool sendEncoder(byte, const void * = NULL, byte = 0);
+
+    /**
+     * Motion in progress.
+     * Rotations and timed drives are bounded; they end by themselves when their duration has passed.
+     * A drive without duration goes on until it is replaced, stopped or cancelled.
+     */
+    struct Motion {
+        enum State : byte { IDLE, DRIVING, ROTATING } state;
+        unsigned long start; // Start time (ms)
+        unsigned long duration; // Length of a bounded motion (ms); 0 for unbounded
+        // Rotations with the encoder
+        bool closedLoop; // Ended by the encoder instead of the duration
+        bool spin; // Both wheels driven in opposite directions
+        byte direction, volt; // Rotation direction and voltage
+        unsigned long startTicks; // Encoder count at start
+        unsigned long lastPoll; // Time of the last encoder read (ms)
+        uint16_t targetTicks; // Ticks to cover
+    } motion;
+
+    /**
+     * Applies the voltage of a rotation to the wheels.
+     * Left rotations spin in place so that the left wheel (with the encoder) moves;
+     * right rotations keep the right wheel fixed.
+     *
+     * @param volt Voltage to be applied
+     */
+    void applyRotation(byte);
+
 public:
     // Directional constants
     const static byte LEFT = 0, FORWARD = 1, RIGHT = 2, BACKWARD = 3;
 
+    /**
+     * Pins of a motor; the positive and negative terminal, both PWM pins.
+     * They are given as a type, so that the writes to the motor are resolved at compile time.
+     */
+    template<byte P, byte N> struct Wiring {
+        const static byte POSITIVE = P, NEGATIVE = N;
+    };
+
     /**
      * Constructor
-     * Initializes motor pins and A/B output pins of encoder.
-     * Also sets pin mode of motor pins.
+     * Sets the motor pins as outputs, LOW until begin(), and joins the I2C bus of the encoder.
+     * All four pins must be on the 16 bit timers (1, 3, 4 or 5).
      * 
-     * @param mPins[][2] (positive, negative) pin pairs of left and right motor respectively.
+     * @param left Pins of the left motor
+     * @param right Pins of the right motor
      * @param base Minimum voltage to be applied
-     */    
-    Driver(byte[][2], byte);
+     */
+    template<byte LP, byte LN, byte RP, byte RN>
+    Driver(Wiring<LP, LN>, Wiring<RP, RN>, byte base) {
+        FastPin<LP>::setOutput();
+        FastPin<LN>::setOutput();
+        FastPin<RP>::setOutput();
+        FastPin<RN>::setOutput();
+        mLeft.start = startMotor<LP, LN>;
+        mLeft.write = writeMotor<LP, LN>;
+        mRight.start = startMotor<RP, RN>;
+        mRight.write = writeMotor<RP, RN>;
+        setup(base);
+    }
+
+    /**
+     * Starts the 20 kHz PWM of the motors, stopped.
+     * Must be called from setup(): the timers are set up by the Arduino core after the global constructors.
+     */
+    void begin();
 
     // Destructor
     ~Driver();
 
+    /**
+     * Sets the minimum voltage applied to the motors; the voltage of every command is added to it.
+     *
+     * @param base Minimum voltage
+     */
+    void setBaseVolt(byte);
+
+    /**
+     * Minimum voltage applied to the motors.
+     *
+     * @return Minimum voltage
+     */
+    byte getBaseVolt();
+
+    /**
+     * Sets the slew limit of the motors: the time taken to ramp from 0 to full voltage.
+     * Every change of voltage is ramped at the same rate, but for stop() and cancel().
+     *
+     * @param ms Ramp time (ms); 0 for no limit
+     */
+    void setRampTime(uint16_t);
+
     /**
      * Drives the bot in desired direction by applying the given voltage to the respective motors.
      * It can also rotate the bot. To rotate, an angle in degree is passed.
@@ -53,9 +271,50 @@ public:
      * @param rotate Rotation angle in degree. Range: 0 to 180 (default = 0)
      */
     void move(byte, byte, byte = 0);
+
+    /**
+     * Starts a rotation by the given angle and returns immediately.
+     * The rotation is measured with the encoder: it's ended by update() once the left wheel has covered
+     * the arc of the rotation, and it's slowed down to base volt near the end.
+     * To keep the encoder wheel moving, right rotations keep the right wheel fixed, and left rotations spin in place.
+     * If the encoder slave doesn't answer, a timed rotation is done instead, keeping one wheel fixed.
+     *
+     * @param direction LEFT or RIGHT
+     * @param volt Voltage to be applied
+     * @param angle Rotation angle in degree. Range: 0 to 180
+     */
+    void rotate(byte, byte, byte);
+
+    /**
+     * Starts driving in the given direction and returns immediately.
+     *
+     * @param direction One of the FORWARD, LEFT, RIGHT or BACKWARD direction
+     * @param volt Voltage to be applied
+     * @param duration Time to drive (ms); 0 to drive until stopped (default = 0)
+     */
+    void drive(byte, byte, unsigned long = 0);
+
+    /**
+     * Advances the motion in progress, and ramps the motors toward its voltages; stops the motors when a bounded
+     * motion is complete.
+     * Must be called on every iteration of the main loop.
+     */
+    void update();
+
+    /**
+     * Checks whether a bounded motion (rotation or timed drive) is in progress.
+     *
+     * @return true until the motion is complete or cancelled
+     */
+    bool busy();
+
+    /**
+     * Pre-empts the motion in progress and stops the motors.
+     */
+    void cancel();
     
     /**
-     * Stops all the motors by writing 0 on all pins.
+     * Stops all the motors by writing 0 on all pins; at once, without ramping down.
      */
     void stop();
     
@@ -69,12 +328,61 @@ public:
      */
     void stopEncoder();
     
+    /**
+     * Clears the tick count of the Slave without stopping it.
+     */
+    void resetEncoder();
+
+    /**
+     * Makes the Slave snapshot its status now. The next readEncoder() returns the snapshot.
+     * Used to tie a reading to an event without waiting for the read.
+     */
+    void latchEncoder();
+
+    /**
+     * Sets the glitch filter and velocity window of the Slave.
+     *
+     * @param minTickInterval Edges closer than this are ignored (us)
+     * @param velocityWindow Velocity is measured over the edges of this window (ms)
+     */
+    void configureEncoder(uint16_t, uint16_t);
+
+    /**
+     * Reads the whole status of the Slave in one burst; a fixed 18 byte transaction (about 1.8 ms at 100 kHz).
+     * The status is rejected if it's short, or has a wrong version or CRC.
+     *
+     * @return true if a valid status was read; it's then available from getEncoderStatus()
+     */
+    bool readEncoder();
+
+    /**
+     * Last valid status read from the Slave.
+     *
+     * @return Status; all zero if none was read
+     */
+    const EncoderProtocol::Status &getEncoderStatus();
+
+    /**
+     * Requests the tick count from the Slave.
+     * The count is reset when the encoder is started, and counts in both directions of rotation.
+     * 
+     * @return Ticks since the encoder was started; -1 if the Slave didn't answer
+     */
+    long getTicks();
+
     /**
      * Requests distance from the Slave.
      * 
-     * @return Distance Travelled
+     * @return Distance Travelled (cm); 0 if the Slave didn't answer
      */
     float getDistanceTravelled();
+
+    /**
+     * Requests the speed of the encoder wheel from the Slave.
+     *
+     * @return Speed (mm/s); negative when known to be backwards; 0 if the Slave didn't answer
+     */
+    int16_t getSpeed();
 };
 
 #endif
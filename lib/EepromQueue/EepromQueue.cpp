@@ -0,0 +1,53 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <EepromQueue.h>
+
+EepromQueue::Write EepromQueue::queue[EepromQueue::CAPACITY];
+byte EepromQueue::head = 0;
+byte EepromQueue::count = 0;
+
+// Queue byte
+void EepromQueue::put(int address, byte value) {
+    // Already queued; the new value replaces it
+    for (byte i = 0; i < count; i++) {
+        Write &w = queue[(head + i) % CAPACITY];
+        if (w.address == address) {
+            w.value = value;
+            return;
+        }
+    }
+
+    if (count == CAPACITY) writeOldest();
+    Write &w = queue[(head + count++) % CAPACITY];
+    w.address = address;
+    w.value = value;
+}
+
+// Write oldest byte; update() skips the unchanged bytes
+void EepromQueue::writeOldest() {
+    const Write &w = queue[head];
+    EEPROM.update(w.address, w.value);
+    head = (head + 1) % CAPACITY;
+    count--;
+}
+
+// Write a byte
+void EepromQueue::update() {
+    // Unchanged bytes cost no write; drop them until a byte needs one
+    while (count && eeprom_is_ready()) {
+        const Write &w = queue[head];
+        bool changed = EEPROM.read(w.address) != w.value;
+        writeOldest();
+        if (changed) return;
+    }
+}
+
+// Write all
+void EepromQueue::flush() {
+    while (count) writeOldest();
+}
+
+// Nothing queued
+bool EepromQueue::flushed() {
+    return count == 0;
+}
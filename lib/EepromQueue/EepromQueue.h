@@ -0,0 +1,71 @@
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <Arduino.h>
+
+/**
+ * Deferred EEPROM writer.
+ * An EEPROM byte takes about 3.3 ms to erase and write, and EEPROM.put() waits for each byte in turn,
+ * so a few changed bytes would stall a control cycle for tens of ms. put() only queues the bytes in RAM;
+ * update() writes at most one per call, and only when the EEPROM is done with the previous one, so it never waits.
+ * The EEPROM writes a byte in the background, while the tasks run.
+ *
+ * A byte queued again before it's written just takes the new value, so the queue holds one entry per address.
+ * Queued bytes are only visible in EEPROM once written; the callers keep what they write in RAM.
+ * A byte equal to the EEPROM contents is dropped when its turn comes, without a write.
+ */
+class EepromQueue {
+public:
+    // Most bytes waiting at once; put() writes the oldest ones itself when the queue is full
+    const static byte CAPACITY = 32;
+
+    /**
+     * Queues the bytes of a value.
+     * When the queue is full, the oldest bytes are written first, waiting for the EEPROM.
+     *
+     * @param address EEPROM address
+     * @param value Value to write
+     */
+    template<typename T> static void put(int address, const T &value) {
+        const byte *bytes = (const byte *) &value;
+        for (size_t i = 0; i < sizeof(T); i++) put(address + i, bytes[i]);
+    }
+
+    /**
+     * Queues a byte.
+     *
+     * @param address EEPROM address
+     * @param value Byte to write
+     */
+    static void put(int, byte);
+
+    /**
+     * Writes the oldest queued byte if the EEPROM is ready, without waiting. Must be called often.
+     */
+    static void update();
+
+    /**
+     * Writes all the queued bytes, waiting for the EEPROM.
+     */
+    static void flush();
+
+    /**
+     * Checks whether all the queued bytes were written.
+     *
+     * @return true if nothing is queued
+     */
+    static bool flushed();
+
+private:
+    struct Write {
+        uint16_t address;
+        byte value;
+    };
+    static Write queue[CAPACITY]; // Ring buffer, oldest first
+    static byte head, count;
+
+    // Writes the oldest byte, waiting for the EEPROM if it's busy
+    static void writeOldest();
+};
+
+#endif
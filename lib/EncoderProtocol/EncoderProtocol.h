@@ -0,0 +1,83 @@
+#ifndef ENCODER_PROTOCOL_H
+#define ENCODER_PROTOCOL_H
+
+#include <Arduino.h>
+
+/**
+ * I2C protocol between the master (Driver) and the PhotoEncoder slave. Shared by both projects.
+ *
+ * Master to slave: a command byte, followed by the payload of the command if it has one.
+ * Slave to master: every read returns the whole Status in one burst.
+ * The slave samples the encoder every millisecond and builds the reply in advance, so a read is only a copy.
+ * All multi-byte values are little-endian; both MCUs are little-endian, so the struct is sent as is.
+ */
+namespace EncoderProtocol {
+    // I2C address of the slave
+    const byte ADDRESS = 8;
+    // Version of the protocol; sent in every status
+    const byte VERSION = 2;
+
+    // Commands
+    enum Command : byte {
+        STOP = 0, // Stop counting and turn off the sensor
+        START = 1, // Turn on the sensor, clear the count and start counting
+        RESET = 2, // Clear the count; keep counting
+        LATCH = 3, // Capture the count now; the next read returns the snapshot (LATCHED) once it's built
+        CONFIG = 4 // Followed by Config
+    };
+
+    // Status flags
+    enum Flag : byte {
+        RUNNING = 0x01, // Counting
+        LATCHED = 0x02, // Status is a snapshot taken by LATCH
+        DIRECTION = 0x04, // Direction is known (second channel)
+        REVERSE = 0x08, // Wheel is turning backwards; valid with DIRECTION
+        GLITCH = 0x10 // Edges were rejected by the glitch filter since the last sample
+    };
+
+    // Payload of the CONFIG command
+    struct Config {
+        uint16_t minTickInterval; // Edges closer than this are glitches (us)
+        uint16_t velocityWindow; // Velocity is measured over the edges of this window (ms)
+    } __attribute__((packed));
+
+    // Reply to every read
+    struct Status {
+        uint8_t version; // VERSION
+        uint8_t seq; // Incremented on every sample; a repeated number means no new sample since the last sample
+        uint8_t flags; // Flag bits
+        uint32_t ticks; // Ticks since START or RESET
+        uint32_t distance; // Distance covered by the wheel since START or RESET (mm * 16)
+        uint32_t timestamp; // Time of the sample on the slave (us)
+        int16_t velocity; // Speed of the wheel (mm/s); negative when REVERSE
+        uint8_t crc; // crc8() of all the bytes above
+    } __attribute__((packed));
+
+    /**
+     * CRC-8 with polynomial x^8 + x^2 + x + 1 (0x07), initial value 0.
+     *
+     * @param data Bytes to check
+     * @param length Number of bytes
+     * @return CRC of the bytes
+     */
+    inline uint8_t crc8(const uint8_t *data, uint8_t length) {
+        uint8_t crc = 0;
+        while (length--) {
+            crc ^= *data++;
+            for (byte bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        return crc;
+    }
+
+    // Sets the CRC of a status
+    inline void seal(Status &status) {
+        status.crc = crc8((const uint8_t *) &status, sizeof(Status) - 1);
+    }
+
+    // Checks the version and CRC of a status
+    inline bool valid(const Status &status) {
+        return status.version == VERSION && status.crc == crc8((const uint8_t *) &status, sizeof(Status) - 1);
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#include <Arduino.h>
+
+/**
+ * Pin map of the board, known at compile time: the Mega2560 of the bot, or the Nano (ATmega328P) of the encoder slave.
+ * digitalPinToPort(), digitalPinToBitMask() and digitalPinToTimer() look the pin up in flash on every call;
+ * these are constexpr, so a pin given as a constant is resolved to its registers and bit by the compiler.
+ * Registers are data memory addresses as used by _SFR_MEM8(). DDRx and PORTx follow PINx.
+ */
+namespace PinMap {
+    // Control register A of every timer; the output compare registers follow it
+    const uint16_t TIMER_0 = 0x44, TIMER_1 = 0x80, TIMER_2 = 0xB0, TIMER_3 = 0x90, TIMER_4 = 0xA0, TIMER_5 = 0x120;
+    // Compare output mode bit (COMnx1) of every channel; non-inverting PWM when set
+    const uint8_t COM_A = _BV(7), COM_B = _BV(5), COM_C = _BV(3);
+
+    // Output compare channel driving a PWM pin
+    struct Compare {
+        uint8_t pin;
+        uint16_t ocr; // Output compare register (OCRnx)
+        uint16_t timer; // Control register A of the timer (TCCRnA)
+        uint8_t com; // Compare output mode bit of the channel
+    };
+
+#if defined(__AVR_ATmega328P__)
+    const uint16_t REG_B = 0x23, REG_C = 0x26, REG_D = 0x29;
+
+    // Input register of every pin
+    constexpr uint16_t INPUT_REG[NUM_DIGITAL_PINS] = {
+        REG_D, REG_D, REG_D, REG_D, REG_D, REG_D, REG_D, REG_D, // 0-7
+        REG_B, REG_B, REG_B, REG_B, REG_B, REG_B, // 8-13
+        REG_C, REG_C, REG_C, REG_C, REG_C, REG_C // 14-19
+    };
+
+    // Bit of every pin within its port
+    constexpr uint8_t BIT[NUM_DIGITAL_PINS] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5
+    };
+
+    // PWM pins
+    constexpr Compare COMPARE[] = {
+        {3, 0xB4, TIMER_2, COM_B}, {5, 0x48, TIMER_0, COM_B}, {6, 0x47, TIMER_0, COM_A},
+        {9, 0x88, TIMER_1, COM_A}, {10, 0x8A, TIMER_1, COM_B}, {11, 0xB3, TIMER_2, COM_A}
+    };
+#else
+    const uint16_t REG_A = 0x20, REG_B = 0x23, REG_C = 0x26, REG_D = 0x29, REG_E = 0x2C, REG_F = 0x2F,
+        REG_G = 0x32, REG_H = 0x100, REG_J = 0x103, REG_K = 0x106, REG_L = 0x109;
+
+    // Input register of every pin
+    constexpr uint16_t INPUT_REG[NUM_DIGITAL_PINS] = {
+        REG_E, REG_E, REG_E, REG_E, REG_G, REG_E, REG_H, REG_H, REG_H, REG_H, // 0-9
+        REG_B, REG_B, REG_B, REG_B, REG_J, REG_J, REG_H, REG_H, REG_D, REG_D, // 10-19
+        REG_D, REG_D, REG_A, REG_A, REG_A, REG_A, REG_A, REG_A, REG_A, REG_A, // 20-29
+        REG_C, REG_C, REG_C, REG_C, REG_C, REG_C, REG_C, REG_C, REG_D, REG_G, // 30-39
+        REG_G, REG_G, REG_L, REG_L, REG_L, REG_L, REG_L, REG_L, REG_L, REG_L, // 40-49
+        REG_B, REG_B, REG_B, REG_B, REG_F, REG_F, REG_F, REG_F, REG_F, REG_F, // 50-59
+        REG_F, REG_F, REG_K, REG_K, REG_K, REG_K, REG_K, REG_K, REG_K, REG_K // 60-69
+    };
+
+    // Bit of every pin within its port
+    constexpr uint8_t BIT[NUM_DIGITAL_PINS] = {
+        0, 1, 4, 5, 5, 3, 3, 4, 5, 6, 4, 5, 6, 7, 1, 0, 1, 0, 3, 2,
+        1, 0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 6, 5, 4, 3, 2, 1, 0, 7, 2,
+        1, 0, 7, 6, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7
+    };
+
+    // PWM pins
+    constexpr Compare COMPARE[] = {
+        {2, 0x9A, TIMER_3, COM_B}, {3, 0x9C, TIMER_3, COM_C}, {4, 0x48, TIMER_0, COM_B}, {5, 0x98, TIMER_3, COM_A},
+        {6, 0xA8, TIMER_4, COM_A}, {7, 0xAA, TIMER_4, COM_B}, {8, 0xAC, TIMER_4, COM_C}, {9, 0xB4, TIMER_2, COM_B},
+        {10, 0xB3, TIMER_2, COM_A}, {11, 0x88, TIMER_1, COM_A}, {12, 0x8A, TIMER_1, COM_B}, {13, 0x47, TIMER_0, COM_A},
+        {44, 0x12C, TIMER_5, COM_C}, {45, 0x12A, TIMER_5, COM_B}, {46, 0x128, TIMER_5, COM_A}
+    };
+#endif
+
+    const uint8_t COMPARE_COUNT = sizeof(COMPARE) / sizeof(COMPARE[0]);
+
+    // Input register of a pin
+    constexpr uint16_t input(uint8_t pin) {
+        return INPUT_REG[pin];
+    }
+
+    // Data direction register of a pin
+    constexpr uint16_t mode(uint8_t pin) {
+        return INPUT_REG[pin] + 1;
+    }
+
+    // Output register of a pin
+    constexpr uint16_t output(uint8_t pin) {
+        return INPUT_REG[pin] + 2;
+    }
+
+    // Bit mask of a pin within its port
+    constexpr uint8_t mask(uint8_t pin) {
+        return 1 << BIT[pin];
+    }
+
+    // Index of the compare channel of a pin from i onwards; COMPARE_COUNT if it has none
+    constexpr uint8_t findCompare(uint8_t pin, uint8_t i = 0) {
+        return (i == COMPARE_COUNT || COMPARE[i].pin == pin) ? i : findCompare(pin, i + 1);
+    }
+
+    // Compare channel of a pin; all zero if it has none
+    constexpr Compare compare(uint8_t pin) {
+        return findCompare(pin) == COMPARE_COUNT ? Compare{pin, 0, 0, 0} : COMPARE[findCompare(pin)];
+    }
+
+    // Whether a timer has 16 bit registers
+    constexpr bool wide(uint16_t timer) {
+        return timer != TIMER_0 && timer != TIMER_2;
+    }
+}
+
+/**
+ * Direct access to a pin whose number is known at compile time.
+ * The registers and mask are constants, so a read or write of a pin on a lower port (A to G on the Mega) is a single
+ * sbi, cbi or sbis instruction, without the table lookups of digitalRead() and digitalWrite(). Ports above the I/O space
+ * need a read-modify-write, which is done with interrupts disabled like digitalWrite() does.
+ *
+ * PWM writes the output compare register of the pin directly, instead of looking up its timer like analogWrite().
+ * The compare output stays connected, so a write is only the store of the new duty.
+ * A 16 bit timer can also be given its own TOP, for a PWM frequency other than the ~490 Hz of the core (see setPwmTop()).
+ *
+ * @tparam PIN Arduino pin number
+ */
+template<uint8_t PIN>
+class FastPin {
+private:
+    static_assert(PIN < NUM_DIGITAL_PINS, "No such pin on the board");
+
+    // Sets or clears the bit of the pin in a register
+    static void change(uint16_t reg, bool set) {
+        if (reg < 0x40) {
+            // I/O space; single instruction
+            if (set) _SFR_MEM8(reg) |= MASK;
+            else _SFR_MEM8(reg) &= ~MASK;
+        } else {
+            uint8_t sreg = SREG;
+            noInterrupts();
+            if (set) _SFR_MEM8(reg) |= MASK;
+            else _SFR_MEM8(reg) &= ~MASK;
+            SREG = sreg;
+        }
+    }
+
+public:
+    // Input register (PINx) of the port
+    const static uint16_t INPUT_REG = PinMap::input(PIN);
+    // Data direction register (DDRx) of the port
+    const static uint16_t MODE_REG = PinMap::mode(PIN);
+    // Output register (PORTx) of the port
+    const static uint16_t OUTPUT_REG = PinMap::output(PIN);
+    // Bit of the pin within its port
+    const static uint8_t MASK = PinMap::mask(PIN);
+
+    // Output compare register driving the pin; 0 if it's not a PWM pin
+    const static uint16_t OCR_REG = PinMap::compare(PIN).ocr;
+    // Control register A of the timer, and the compare output mode bit of the pin in it
+    const static uint16_t TIMER_REG = PinMap::compare(PIN).timer;
+    const static uint8_t COM = PinMap::compare(PIN).com;
+
+    /**
+     * Reads the pin.
+     *
+     * @return true if the pin is HIGH
+     */
+    static bool read() {
+        return _SFR_MEM8(INPUT_REG) & MASK;
+    }
+
+    // Makes the pin an output
+    static void setOutput() {
+        change(MODE_REG, true);
+    }
+
+    // Makes the pin an input, without pull-up
+    static void setInput() {
+        change(MODE_REG, false);
+        change(OUTPUT_REG, false);
+    }
+
+    /**
+     * Drives the output.
+     *
+     * @param high true for HIGH
+     */
+    static void write(bool high) {
+        change(OUTPUT_REG, high);
+    }
+
+    /**
+     * Makes the pin a PWM output at duty 0, and connects it to its compare channel.
+     * The timer itself keeps its mode: the one set by the Arduino core (phase correct 8 bit on all the timers
+     * but Timer0, whose fast PWM mode is handled by pwm()), or the one set by setPwmTop().
+     */
+    static void startPwm() {
+        static_assert(OCR_REG != 0, "Not a PWM pin");
+        write(false);
+        setOutput();
+        if (TIMER_REG != PinMap::TIMER_0) _SFR_MEM8(TIMER_REG) |= COM;
+        pwm(0);
+    }
+
+    /**
+     * Sets the duty of a PWM output; one store to the compare register, high byte first on the 16 bit timers.
+     * On Timer0 (fast PWM), duty 0 still gives a short pulse every period, so the compare output is disconnected then.
+     *
+     * @param duty 0 (LOW) to 255 (HIGH)
+     */
+    static void pwm(uint8_t duty) {
+        static_assert(OCR_REG != 0, "Not a PWM pin");
+        if (TIMER_REG == PinMap::TIMER_0) {
+            if (duty) _SFR_MEM8(TIMER_REG) |= COM;
+            else _SFR_MEM8(TIMER_REG) &= ~COM;
+        }
+        setCompare(duty);
+    }
+
+    /**
+     * Runs the timer of the pin in phase correct PWM with ICRn as TOP (mode 10), at the CPU clock:
+     * the frequency is F_CPU / (2 * top), and the duty is the compare value / top.
+     * It replaces the mode set up by init(), so it must be called from setup(); it applies to every channel of the timer.
+     *
+     * @param top TOP of the counter; the resolution of the duty
+     */
+    static void setPwmTop(uint16_t top) {
+        static_assert(OCR_REG != 0 && PinMap::wide(TIMER_REG), "Only the 16 bit timers have a TOP register");
+        uint8_t sreg = SREG;
+        noInterrupts();
+        // WGMn1 in TCCRnA, next to the compare output bits; WGMn3 and no prescaler in TCCRnB
+        _SFR_MEM8(TIMER_REG) = (_SFR_MEM8(TIMER_REG) & ~(_BV(1) | _BV(0))) | _BV(1);
+        _SFR_MEM8(TIMER_REG + 1) = _BV(4) | _BV(0);
+        // TOP isn't buffered in this mode; restart the count so that it's not already above the new TOP
+        _SFR_MEM16(TIMER_REG + 4) = 0; // TCNTn
+        _SFR_MEM16(TIMER_REG + 6) = top; // ICRn
+        SREG = sreg;
+    }
+
+    /**
+     * Stores a compare value of a PWM output, high byte first on the 16 bit timers.
+     * Without the Timer0 handling of pwm(); for the full range of a timer set up by setPwmTop().
+     *
+     * @param value 0 (LOW) to TOP (HIGH)
+     */
+    static void setCompare(uint16_t value) {
+        static_assert(OCR_REG != 0, "Not a PWM pin");
+        if (PinMap::wide(TIMER_REG)) _SFR_MEM16(OCR_REG) = value;
+        else _SFR_MEM8(OCR_REG) = value;
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include <Arduino.h>
+#include <LcdBuffer.h>
+
+// Constructor
+LcdBuffer::LcdBuffer(uint8_t addr, uint8_t cols, uint8_t rows) : lcd(addr, cols, rows) {
+    this->cols = min(cols, MAX_COLS);
+    this->rows = min(rows, MAX_ROWS);
+    memset(shadow, ' ', sizeof(shadow));
+    memset(shown, ' ', sizeof(shown));
+    col = row = 0;
+    lcdCol = 0;
+    lcdRow = MAX_ROWS;
+    cellCost = 0;
+}
+
+// Initialize display
+void LcdBuffer::begin(uint32_t clock) {
+    lcd.begin(clock); // Clears the display
+    memset(shown, ' ', sizeof(shown));
+    lcdCol = lcdRow = 0;
+}
+
+// Clear framebuffer
+void LcdBuffer::clear() {
+    memset(shadow, ' ', sizeof(shadow));
+    col = row = 0;
+}
+
+// Move cursor
+void LcdBuffer::setCursor(uint8_t col, uint8_t row) {
+    this->col = col;
+    this->row = min(row, (uint8_t) (rows - 1));
+}
+
+// Write character
+size_t LcdBuffer::write(uint8_t c) {
+    if (col >= cols) return 0; // Past the last column
+    shadow[row][col++] = c;
+    return 1;
+}
+
+// Push changed cells
+void LcdBuffer::flush(unsigned long budget) {
+    unsigned long start = micros();
+    bool first = true;
+    for (byte r = 0; r < rows; r++)
+        for (byte c = 0; c < cols; c++) {
+            if (shadow[r][c] == shown[r][c]) continue;
+
+            // Run of changed cells, written in one go; a jump costs about as much as a character
+            bool jump = lcdRow != r || lcdCol != c;
+            byte run = 1;
+            while (c + run < cols && shadow[r][c + run] != shown[r][c + run]) run++;
+
+            // Cut the run to the time left; the first cell of a call, or the jump to it, is always written
+            if (cellCost) {
+                unsigned long elapsed = micros() - start;
+                unsigned long fit = (elapsed < budget) ? (budget - elapsed) / cellCost : 0;
+                if (first && !fit) fit = 1;
+                if (fit <= jump) {
+                    // Only the jump fits; the cells are left to the next call
+                    if (fit) {
+                        lcd.setCursor(c, r);
+                        lcdRow = r;
+                        lcdCol = c;
+                    }
+                    return;
+                }
+                if (fit - jump < run) run = fit - jump;
+            }
+            first = false;
+
+            unsigned long runStart = micros();
+            if (jump) lcd.setCursor(c, r);
+            lcd.write((const uint8_t *) &shadow[r][c], run);
+            memcpy(&shown[r][c], &shadow[r][c], run);
+            lcdRow = r;
+            lcdCol = c + run;
+            cellCost = (micros() - runStart) / (run + jump);
+            c += run - 1;
+        }
+}
+
+// Display is up to date
+bool LcdBuffer::flushed() {
+    return memcmp(shadow, shown, sizeof(shadow)) == 0;
+}
@@ -0,0 +1,84 @@
+#ifndef LCD_BUFFER_H
+#define LCD_BUFFER_H
+
+#include <Arduino.h>
+#include <LiquidCrystal_I2C.h>
+
+/**
+ * Framebuffer in front of the I2C LCD.
+ * print(), setCursor() and clear() only change a shadow copy of the display in RAM.
+ * The cells that differ from what the display shows are pushed by flush(), a few per call,
+ * so that the display never takes more than a bounded slice of a control cycle.
+ * Runs of adjacent changed cells are written together, and a jump to another cell costs one more command.
+ */
+class LcdBuffer : public Print {
+private:
+    // Largest supported display
+    const static byte MAX_COLS = 16, MAX_ROWS = 2;
+
+    LiquidCrystal_I2C lcd; // Display
+    byte cols, rows;
+    char shadow[MAX_ROWS][MAX_COLS]; // Contents to be shown
+    char shown[MAX_ROWS][MAX_COLS]; // Contents of the display
+    byte col, row; // Cursor of print()
+    byte lcdCol, lcdRow; // Address counter of the display; lcdRow is MAX_ROWS if unknown
+    unsigned long cellCost; // Time per cell of the last run written (us)
+
+public:
+    /**
+     * Constructor
+     *
+     * @param addr I2C address of the display
+     * @param cols Number of columns; up to 16
+     * @param rows Number of rows; up to 2
+     */
+    LcdBuffer(uint8_t, uint8_t, uint8_t);
+
+    /**
+     * Initializes the display. Blocks for about a second.
+     *
+     * @param clock I2C bus clock (Hz); see LiquidCrystal_I2C::begin()
+     */
+    void begin(uint32_t = 100000);
+
+    /**
+     * Fills the framebuffer with spaces and moves the cursor to the first cell.
+     * Unlike the display command, it doesn't block for 2 ms.
+     */
+    void clear();
+
+    /**
+     * Moves the cursor of print().
+     *
+     * @param col Column
+     * @param row Row
+     */
+    void setCursor(uint8_t, uint8_t);
+
+    /**
+     * Writes a character at the cursor and advances it. Characters past the last column are dropped.
+     * Used by all the print() methods.
+     *
+     * @param c Character
+     * @return 1 if the character was stored, 0 otherwise
+     */
+    virtual size_t write(uint8_t);
+
+    /**
+     * Pushes the changed cells to the display, in reading order, until the time budget is used up.
+     * Cells are only written if they're expected to finish within the budget, but at least one cell is always written,
+     * so a call never takes longer than the budget or a single cell, whichever is larger.
+     *
+     * @param budget Time allowed (us); all the changed cells are written by default
+     */
+    void flush(unsigned long = 0xFFFFFFFF);
+
+    /**
+     * Checks whether the display shows the framebuffer.
+     *
+     * @return true if no cell is waiting for flush()
+     */
+    bool flushed();
+};
+
+#endif
@@ -1,84 +1,536 @@
 #ifndef LINE_DETECTOR_H
 #define LINE_DETECTOR_H
 
+#include <Arduino.h>
+#include <Pid.h>
+#include <FastPin.h>
+
+// Frame type of an array; one byte holds up to 8 sensors
+template<bool WIDE> struct LineFrame { typedef uint8_t type; };
+template<> struct LineFrame<true> { typedef uint16_t type; };
+
+/**
+ * Layout of an array of N sensors: weights, errors and node patterns of its frames.
+ * It is complete before LineDetector, so its constexpr functions can initialise the constants of the detector.
+ *
+ * @tparam N Number of sensors
+ */
+template<byte N>
+struct LineGeometry {
+    // A frame packs one reading of every sensor; bit i is sensor i (left to right)
+    typedef typename LineFrame<(N > 8)>::type Frame;
+
+    // Frame with every sensor off the line
+    const static Frame ALL_OFF = (Frame) ((1UL << N) - 1);
+    // Frame bits of the middle sensor(s)
+    const static Frame MIDDLE = (Frame) ((N % 2) ? (1UL << N/2) : (3UL << (N/2 - 1)));
+    // Frame bits of the left half of the array
+    const static Frame FIRST_HALF = (Frame) ((1UL << N/2) - 1);
+
+    /**
+     * Weight of sensor i. For 8 sensors: -3 -2 -1 0 0 1 2 3
+     * For even number of sensors, weight start with one less than the half of sensor count and the two sensors in the middle have weight = 0.
+     * For odd number of sensors, weight starts with half of the sensor count.
+     */
+    static constexpr int8_t weight(byte i) {
+        return (N % 2 || i < N/2) ? i - (N - 1)/2 : i - N/2;
+    }
+
+    // Sum of the weights of sensors from i onwards which are off line
+    static constexpr int8_t error(Frame frame, byte i = 0) {
+        return (i == N) ? 0 : ((frame >> i) & 1) * weight(i) + error(frame, i + 1);
+    }
+
+    /**
+     * Node pattern repeated over the whole array. Every 4 sensors follow the same OFF/ON pattern.
+     * With bit i of base being the value of sensor i % 4.
+     */
+    static constexpr Frame nodePattern(uint8_t base, byte i = 0) {
+        return (i == N) ? 0 : (Frame) ((((base >> (i % 4)) & 1UL) << i) | nodePattern(base, i + 1));
+    }
+};
+
 /**
  * Line detector library provides line following and maze solving helpers.
  * The class interacts with the IR sensor array.
+ *
+ * The sensor count and pins are template parameters, so an array of another size or wiring only needs another
+ * LineDetector type. The weights, node patterns, MAX_ERROR and the register and bit of every pin are constants;
+ * the reads are unrolled per sensor and need no pin data in RAM.
+ * Frames of up to 8 sensors are classified with a precomputed table in flash; wider frames are classified on the fly.
+ *
+ * @tparam N Number of sensors; 2 to 16
+ * @tparam PINS Sensor pins in left to right sequence
  */
-class LineDetector{
+template<byte N, byte... PINS>
+class LineDetector {
+private:
+    static_assert(sizeof...(PINS) == N, "One pin is needed per sensor");
+    static_assert(N >= 2 && N <= 16, "Sensor frame must fit in 16 bits");
+
+    typedef LineGeometry<N> Geometry;
+public:
+    typedef typename Geometry::Frame Frame;
+
 private:
-    // Maximum number of sensors available
-    const static byte MAX_SENSORS = 8;
+    const static Frame ALL_OFF = Geometry::ALL_OFF,
+        MIDDLE = Geometry::MIDDLE,
+        FIRST_HALF = Geometry::FIRST_HALF;
+
+    // Node patterns, see LineDetector::isNode()
+    const static Frame ALIGNED = Geometry::nodePattern(0x9), // Perfectly aligned: 1,0,0,1
+        RIGHT_SHIFTED = Geometry::nodePattern(0xC), // Right shifted: 0,0,1,1
+        LEFT_SHIFTED = Geometry::nodePattern(0x3); // Left shifted: 1,1,0,0
+
+    // Sensor pins, left to right
+    static constexpr byte PIN[N] = {PINS...};
+
+    // Whether the frames are classified with the lookup table; it has 2^N entries
+    const static bool TABULATED = N <= 8;
+    // Number of entries of the lookup table
+    const static uint16_t FRAME_COUNT = TABULATED ? 1 << N : 1;
+
+    // Classification flags of a frame
+    const static uint8_t NODE = 0x01, // Frame matches a node pattern
+        CROSS_SECTION = 0x02, // All sensors on line
+        OFF_LINE = 0x04, // No sensor on line
+        JUNCTION_120 = 0x08, // Only middle sensors off line
+        TURN_90 = 0x10, // One half of the array on line
+        FALSE_NODE = 0x20; // Middle sensors on line
 
     /**
-     * The bot currently contains a line sensor array with 8 IR sensors.
-     * However, the number of sensors are stored in a variable and not used directly in methods.
-     * Unline ultrasonic sensors and motors, change in number of IR sensors doesn't affect overall working of the bot.
-     * Each sensor has an assigned pin and a weight. It also stores the last read value.
+     * Everything known about a frame: the net deviation and the classification flags.
+     * One entry is precomputed for every possible frame, so a read is classified with one table lookup.
      */
+    struct FrameInfo {
+        int8_t error;
+        uint8_t flags;
+    };
+
+    // Lookup table of all possible frames; stored in flash
+    struct FrameTable {
+        FrameInfo entries[FRAME_COUNT];
+    };
+    static const FrameTable FRAMES;
+
+    // Whether the frame matches one of the node patterns
+    static constexpr bool isNodePattern(Frame frame) {
+        return frame == ALIGNED || frame == RIGHT_SHIFTED || frame == LEFT_SHIFTED;
+    }
+
+    // Classification flags of a frame
+    static constexpr uint8_t classify(Frame frame) {
+        return (isNodePattern(frame) ? NODE : 0)
+            | (frame == 0 ? CROSS_SECTION : 0)
+            | (frame == ALL_OFF ? OFF_LINE : 0)
+            | (frame == MIDDLE ? JUNCTION_120 : 0)
+            | (!(frame & FIRST_HALF) || !(frame & ~FIRST_HALF & ALL_OFF) ? TURN_90 : 0)
+            | (!(frame & MIDDLE) ? FALSE_NODE : 0);
+    }
+
+    // Compile-time sequence of frames, used to generate the lookup table
+    template<unsigned... I> struct Frames {};
+    template<unsigned C, unsigned... I> struct MakeFrames : MakeFrames<C - 1, C - 1, I...> {};
+    template<unsigned... I> struct MakeFrames<0, I...> { typedef Frames<I...> type; };
+
+    // Generates the table entry of every frame in the sequence
+    template<unsigned... I> static constexpr FrameTable tabulate(Frames<I...>) {
+        return FrameTable{{ FrameInfo{Geometry::error(I), classify(I)}... }};
+    }
+
+    // Frame bit of sensor i
+    static constexpr Frame sensorBit(byte i) {
+        return (Frame) (1U << i);
+    }
+
+    // Whether sensors from i onwards are on the port of the first sensor
+    static constexpr bool onePort(byte i = 0) {
+        return i == N || (PinMap::input(PIN[i]) == PinMap::input(PIN[0]) && onePort(i + 1));
+    }
+
+    // Whether sensors from i onwards are on the bit of their number
+    static constexpr bool inOrder(byte i = 0) {
+        return i == N || (PinMap::mask(PIN[i]) == sensorBit(i) && inOrder(i + 1));
+    }
+
+    /**
+     * Sensor number as a type. The per-sensor helpers are called for Sensor<0> and recurse up to Sensor<N>,
+     * so every loop over the sensors is unrolled with the pin of each step as a constant.
+     */
+    template<byte I> struct Sensor {};
+
+    // In analog mode, each sensor stores its calibrated range and the last read level; unused in digital mode
     struct IRSensor {
-        byte pin;
-        int8_t weight;
-        bool value; // Values are digitally read, so it can be stored in boolean type.
-    } sensors[MAX_SENSORS];
-    
-    int errSum, // Sum of all caluclated errors; Used in PID
-        prevErr; // Stores last recorded error
+        uint16_t min, max; // Lowest and highest raw value seen during calibration
+        uint16_t level; // Calibrated reading; 0 (off line) to LEVEL_MAX (on line)
+    } sensors[N];
+
+    // Whether the sensors are read as analog values
+    bool analog;
+    // Calibrated level of a sensor right on the line
+    const static uint16_t LEVEL_MAX = 1000;
+    // Smallest calibrated range (raw ADC counts) that is used; narrower ranges are only noise
+    const static uint16_t MIN_RANGE = 100;
+
+    /**
+     * Last read frame. Bit i stores the value of sensor i (left to right).
+     * A set bit means the sensor reads HIGH, i.e., it is off the line.
+     */
+    Frame frame;
+    // Classification flags of the last read frame
+    uint8_t flags;
+
+    // Number of frames kept in history
+    const static byte HISTORY = 8;
+    // Ring buffer of the last read frames; head is the slot of the oldest frame
+    Frame history[HISTORY];
+    byte head;
+
+    /**
+     * Debounced events. Each feature keeps a window of the last HISTORY frames (bit i set if seen i frames ago),
+     * and a count of consecutive frames where it is missing.
+     * A feature is entered when seen in DEBOUNCE frames of its window,
+     * and exited when missing from DEBOUNCE consecutive frames. The window is cleared on exit.
+     */
+    struct Feature {
+        uint8_t flag; // Classification flag of the feature
+        uint8_t entered, exited; // Events fired when the feature is entered and exited
+        uint8_t window;
+        byte missed;
+        bool active;
+    } features[2]; // Node and cross-section
+    // Frames needed to enter or exit a feature; 3 ms at the 1 kHz line task, a few mm of travel
+    const static byte DEBOUNCE = 3;
+    // Events fired by the last read frame
+    uint8_t events;
+
+    // PID controller for line following; gains in Q8
+    Pid<int16_t, 8> pid;
+
+    // Sets the sensor pins as inputs
+    template<byte I> static void setInputs(Sensor<I>) {
+        pinMode(PIN[I], INPUT);
+        setInputs(Sensor<I + 1>());
+    }
+    static void setInputs(Sensor<N>) {}
+
+    // Packs the sensors from I onwards; raw is the port value if all sensors share a port
+    template<byte I> static Frame readSensors(uint8_t raw, Sensor<I>) {
+        typedef FastPin<PIN[I]> Pin;
+        constexpr bool ONE_PORT = onePort();
+        bool off = ONE_PORT ? (raw & Pin::MASK) : Pin::read();
+        return (off ? sensorBit(I) : 0) | readSensors(raw, Sensor<I + 1>());
+    }
+    static Frame readSensors(uint8_t, Sensor<N>) {
+        return 0;
+    }
+
+    /**
+     * Reads all the sensors into a packed frame.
+     * The wiring is known at compile time: single port wiring needs only one register read,
+     * and if the sensors are also in order (sensor i on bit i), the port value is the frame itself.
+     * Mixed wiring reads the register of each sensor.
+     *
+     * @return Packed frame
+     */
+    static Frame readFrame() {
+        constexpr bool ONE_PORT = onePort(), IN_ORDER = ONE_PORT && inOrder();
+        uint8_t raw = ONE_PORT ? _SFR_MEM8(PinMap::input(PIN[0])) : 0;
+        if (IN_ORDER) return raw & ALL_OFF;
+        return readSensors(raw, Sensor<0>());
+    }
+
+    // Reads the sensors from I onwards as analog values, and packs the thresholded levels
+    template<byte I> Frame readLevels(Sensor<I>) {
+        IRSensor &s = sensors[I];
+        uint16_t raw = analogRead(PIN[I]);
+        // Sensors read low on the line
+        if (s.max < s.min + MIN_RANGE) s.level = (raw < 512) ? LEVEL_MAX : 0; // Not calibrated, or never saw both surfaces
+        else if (raw <= s.min) s.level = LEVEL_MAX;
+        else if (raw >= s.max) s.level = 0;
+        else s.level = (uint32_t) (s.max - raw) * LEVEL_MAX / (s.max - s.min);
+
+        Frame off = (s.level < LEVEL_MAX / 2) ? sensorBit(I) : 0; // Off line
+        return off | readLevels(Sensor<I + 1>());
+    }
+    Frame readLevels(Sensor<N>) {
+        return 0;
+    }
+
+    /**
+     * Reads all the sensors as analog values and stores their calibrated levels.
+     * A sensor is off the line if its level is below half of LEVEL_MAX.
+     *
+     * @return Packed frame of the thresholded levels
+     */
+    Frame readAnalogFrame() {
+        return readLevels(Sensor<0>());
+    }
+
+    // Widens the calibrated range of the sensors from I onwards
+    template<byte I> void sampleRange(Sensor<I>) {
+        IRSensor &s = sensors[I];
+        uint16_t raw = analogRead(PIN[I]);
+        if (raw < s.min) s.min = raw;
+        if (raw > s.max) s.max = raw;
+        sampleRange(Sensor<I + 1>());
+    }
+    void sampleRange(Sensor<N>) {}
+
+    // Adds the levels of the sensors from I onwards, and their moments about the middle of the array
+    template<byte I> void sumLevels(int32_t &sum, int32_t &total, Sensor<I>) {
+        // Evenly spaced positions: -7 -5 -3 -1 1 3 5 7 for 8 sensors
+        sum += (int32_t) sensors[I].level * (2 * I - (N - 1));
+        total += sensors[I].level;
+        sumLevels(sum, total, Sensor<I + 1>());
+    }
+    void sumLevels(int32_t &, int32_t &, Sensor<N>) {}
+
+    /**
+     * Calculates the deviation from the weighted centroid of the sensor levels.
+     * It uses evenly spaced sensor positions, and is scaled to the same range as the digital error times ANALOG_SCALE.
+     * Deviation within half a digital step is reported as zero, so a centered line reads exactly zero.
+     *
+     * @return The net deviation
+     */
+    int centroidError() {
+        // No line position if all sensors agree
+        if (frame == 0 || frame == ALL_OFF) return 0;
+
+        int32_t sum = 0, total = 0;
+        sumLevels(sum, total, Sensor<0>());
+        // Line on the left means deviation to the right
+        int err = -sum * (MAX_ERROR * ANALOG_SCALE) / (total * (N - 1));
+        return (abs(err) < ANALOG_SCALE / 2) ? 0 : err;
+    }
+
+    // Sum of the weights of the sensors from I onwards which are off line
+    template<byte I> static int8_t sumWeights(Frame frame, Sensor<I>) {
+        return ((frame & sensorBit(I)) ? Geometry::weight(I) : 0) + sumWeights(frame, Sensor<I + 1>());
+    }
+    static int8_t sumWeights(Frame, Sensor<N>) {
+        return 0;
+    }
+
+    // Deviation and classification of a frame; looked up in flash, or computed for arrays too wide for a table
+    static FrameInfo lookup(Frame frame) {
+        FrameInfo info;
+        if (TABULATED) memcpy_P(&info, &FRAMES.entries[TABULATED ? frame : 0], sizeof(info));
+        else info = FrameInfo{sumWeights(frame, Sensor<0>()), classify(frame)};
+        return info;
+    }
+
+    // Stores the last read frame in history and updates the features.
+    void updateEvents() {
+        // Replace the oldest frame
+        history[head] = frame;
+        head = (head + 1) % HISTORY;
+
+        events = 0;
+        for (Feature &f : features) {
+            f.window <<= 1;
+            if (flags & f.flag) {
+                f.window |= 1;
+                f.missed = 0;
+            } else if (f.missed < HISTORY) f.missed++;
+
+            if (!f.active && __builtin_popcount(f.window) >= DEBOUNCE) {
+                // Seen in enough recent frames
+                f.active = true;
+                events |= f.entered;
+            } else if (f.active && f.missed >= DEBOUNCE) {
+                // Missing for enough consecutive frames
+                f.active = false;
+                f.window = 0;
+                events |= f.exited;
+            }
+        }
+    }
+
 public:
-    // Maximum error that can be calculated by the sensor. 
-    int MAX_ERROR;
+    // Maximum error that can be calculated by the sensor in digital mode
+    const static int8_t MAX_ERROR = Geometry::error(ALL_OFF & ~FIRST_HALF);
+    // Resolution of the analog error; one step of the digital error is split in these many parts
+    const static int8_t ANALOG_SCALE = 16;
+
+    // Number of sensors
+    const static byte SENSORS = N;
+
+    // Debounced events, see LineDetector::getEvents()
+    const static uint8_t NODE_ENTERED = 0x01,
+        NODE_EXITED = 0x02,
+        CROSS_ENTERED = 0x04,
+        CROSS_EXITED = 0x08;
 
     /**
      * Constructor
-     * Initializes the sensors[] array.
-     * The weight for the pins is caluclated based on the number of sensors.
-     * It also initializes errSum and prevErr to zero.
-     * Calculted MAX_ERROR
-     * 
-     * @param pins Sensor pins in left to right sequence
-     */
-    LineDetector(byte[]);
-    
-    // Destructor
-    ~LineDetector();
-    
+     * Sets the sensor pins as inputs.
+     * It also sets up the PID controller.
+     *
+     * @param analog Whether the sensors are read as analog values (default = false)
+     */
+    // kP = 0.5 holds the line on the straights; the deviation alone used to steer with zero voltage
+    // TODO tune kI and kD on the bot
+    LineDetector(bool analog = false) : pid(128, 0, 0) {
+        setInputs(Sensor<0>());
+        this->analog = analog;
+        beginCalibration();
+
+        frame = ALL_OFF;
+        flags = classify(frame);
+
+        // History starts off line
+        for (byte i = 0; i < HISTORY; i++) history[i] = ALL_OFF;
+        head = 0;
+        features[0] = {NODE, NODE_ENTERED, NODE_EXITED, 0, 0, false};
+        features[1] = {CROSS_SECTION, CROSS_ENTERED, CROSS_EXITED, 0, 0, false};
+        events = 0;
+    }
+
+    /**
+     * Pin of a sensor.
+     *
+     * @param i Sensor number, left to right
+     * @return Pin
+     */
+    static constexpr byte pin(byte i) {
+        return PIN[i];
+    }
+
     /**
      * Calculates and returns the devaition of the bot from the line.
      * It uses the weights of the sensors and adds all the weights of the sensors which are off the line.
+     * The deviation and classification of the frame are looked up from a precomputed table, so the
+     * other checks don't read the sensors again.
      * If returned value is negative, bot is deviating to the left.
      * If returned value is positive, bot is deviating to the right.
      * If returned value is zero, bot is moving straight.
-     * 
+     * In analog mode, the deviation is the weighted centroid of the calibrated sensor levels, which has
+     * ANALOG_SCALE steps between two digital values, up to MAX_ERROR * ANALOG_SCALE.
+     *
      * @return The net deviation.
      */
-    int detect();
+    int detect() {
+        frame = analog ? readAnalogFrame() : readFrame();
+        FrameInfo info = lookup(frame);
+        flags = info.flags;
+        updateEvents();
+
+        // Return net deviation
+        return analog ? centroidError() : info.error;
+    }
+
+    /**
+     * Starts a new calibration of the analog sensors.
+     * Clears the stored range of every sensor and speeds up the ADC clock.
+     */
+    void beginCalibration() {
+        for (byte i = 0; i < N; i++) {
+            sensors[i].min = 1023;
+            sensors[i].max = 0;
+        }
+#ifdef ADCSRA
+        // ADC clock = 16 MHz / 16; a conversion takes ~13 us instead of ~104 us
+        if (analog) ADCSRA = (ADCSRA & ~0x07) | 0x04;
+#endif
+    }
+
+    /**
+     * Reads all the sensors once and widens their calibrated range.
+     * Must be called repeatedly while the array is swept across the line.
+     */
+    void calibrate() {
+        sampleRange(Sensor<0>());
+    }
+
+    // Calibrated range of all the sensors, kept across a reset
+    struct Calibration {
+        uint16_t min[N], max[N];
+    };
+
+    /**
+     * Copies the calibrated range of the sensors.
+     *
+     * @param calibration Filled with the range of every sensor
+     */
+    void getCalibration(Calibration &calibration) {
+        for (byte i = 0; i < N; i++) {
+            calibration.min[i] = sensors[i].min;
+            calibration.max[i] = sensors[i].max;
+        }
+    }
+
+    /**
+     * Restores a calibration taken earlier, instead of calibrating again. Speeds up the ADC clock like beginCalibration().
+     *
+     * @param calibration Range of every sensor
+     */
+    void setCalibration(const Calibration &calibration) {
+        beginCalibration();
+        for (byte i = 0; i < N; i++) {
+            sensors[i].min = calibration.min[i];
+            sensors[i].max = calibration.max[i];
+        }
+    }
+
+    /**
+     * Returns a frame from history. The frame read by the last LineDetector::detect() call has age 0.
+     * Bit i is set when sensor i (left to right) is off the line.
+     *
+     * @param age Number of frames read after the requested one (default = 0)
+     * @return Packed frame
+     */
+    Frame getFrame(byte age = 0) {
+        if (age >= HISTORY) return ALL_OFF;
+        return history[(head + HISTORY - 1 - age) % HISTORY];
+    }
+
+    /**
+     * Returns the debounced events fired by the last LineDetector::detect() call.
+     * A node or cross-section is entered when it is seen in 3 of the last 8 frames,
+     * and exited when it is missing from 3 consecutive frames.
+     * So each event fires exactly once per physical feature, even if single frames are noisy.
+     *
+     * @return Mask of NODE_ENTERED, NODE_EXITED, CROSS_ENTERED and CROSS_EXITED
+     */
+    uint8_t getEvents() {
+        return events;
+    }
 
     /**
      * Calculates the voltage to be applied to the motors, using the error value.
      * The error value must be calculated using the LineDetector::detect() method.
-     * 
+     * The shared fixed point PID controller is used, which accounts for the actual time between calls.
+     *
      * @param err The deviation of the bot
      * @return Volage to be applied
      */
-    int calcVolt(int);
+    int calcVolt(int err) {
+        int retval = pid.update(err);
+        return (retval < 0) ? -retval : retval; // Return absolute value
+    }
 
     /**
      * Checks whether the bot is on a cross-section or not.
      * It does that by simply checking if all sensors are on the line.
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return Cross-section status
      */
-    bool isCrossSection();
+    bool isCrossSection() {
+        return flags & CROSS_SECTION;
+    }
 
     /**
      * Checks whether the bot is off the line.
      * If all sensors read value 1 (HIGH), then bot is off line.
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return Line status
      */
-    bool isOffLine();
+    bool isOffLine() {
+        return flags & OFF_LINE;
+    }
 
     /**
      * Checks for the beginning of a node.
@@ -89,31 +541,43 @@ public:
      * Perfectly alligned | 1 | 0 | 0 | 1 | 1 | 0 | 0 | 1
      * Right shifted      | 0 | 0 | 1 | 1 | 0 | 0 | 1 | 1
      * Left shifted       | 1 | 1 | 0 | 0 | 1 | 1 | 0 | 0
+     * Arrays of other sizes repeat the same 4 sensor pattern.
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return Node status
      */
-    bool isNode();
+    bool isNode() {
+        return flags & NODE;
+    }
 
     /**
      * Determines the type of node based on it's middle section.
      * In a false node, the two center nodes lie on black surface.
      * In a true node, all nodes on are white surface.
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return "TRUE" or "FALSE"
      */
-    String nodeType();
+    String nodeType() {
+        // If the center two sensors are on black
+        if (flags & FALSE_NODE)
+            // FALSE node
+            return "FALSE";
+        // All on white; TRUE node
+        return "TRUE "; // whitespace in the end to match string length of "FALSE"
+    }
 
     /**
      * Checks if the bot is at a 120 degree junction.
      * Here, the line spilts into two lines, each making 120 degrees with the other. The lines are 3cm wide.
      * A junction will be detected if the two sensors in the center read DIGITAL HIGH while all other sensors read DIGITAL LOW.
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return Junciton status
      */
-    bool is120Junction();
+    bool is120Junction() {
+        return flags & JUNCTION_120;
+    }
 
     /**
      * Checks whether the bot is on a 90 degree turn.
@@ -121,10 +585,20 @@ public:
      *  - Line sensor must record maximum error (checked externally)
      *  - Half of the sensors must read zero value
      * The LineDetector::detect() method must be invoked before calling this method since it uses the value read by the sensors.
-     * 
+     *
      * @return Turn status
      */
-    bool is90Turn();
+    bool is90Turn() {
+        return flags & TURN_90;
+    }
 };
 
+template<byte N, byte... PINS>
+constexpr byte LineDetector<N, PINS...>::PIN[N];
+
+// Frame lookup table, generated at compile time
+template<byte N, byte... PINS>
+const typename LineDetector<N, PINS...>::FrameTable LineDetector<N, PINS...>::FRAMES PROGMEM =
+    tabulate(typename MakeFrames<FRAME_COUNT>::type());
+
 #endif
@@ -31,8 +31,9 @@ LiquidCrystal_I2C::LiquidCrystal_I2C(uint8_t lcd_addr, uint8_t lcd_cols, uint8_t
 	_backlightval = LCD_BACKLIGHT;
 }
 
-void LiquidCrystal_I2C::begin() {
+void LiquidCrystal_I2C::begin(uint32_t clock) {
 	Wire.begin();
+	Wire.setClock(clock);
 	_displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
 
 	if (_rows > 1) {
@@ -208,15 +209,51 @@ inline size_t LiquidCrystal_I2C::write(uint8_t value) {
 	return 1;
 }
 
+// Several characters per I2C transaction
+size_t LiquidCrystal_I2C::write(const uint8_t *buffer, size_t size) {
+	uint8_t states[BUFFER_LENGTH];
+	size_t n = 0;
+	while (n < size) {
+		uint8_t length = 0;
+		while (n < size && length + 1 + STATES_PER_BYTE <= BUFFER_LENGTH) {
+			length += queue(states + length, buffer[n++], Rs, length == 0);
+		}
+		transmit(states, length);
+	}
+	return n;
+}
+
 
 /************ low level data pushing commands **********/
 
-// write either command or data
+// write either command or data, in one I2C transaction
 void LiquidCrystal_I2C::send(uint8_t value, uint8_t mode) {
-	uint8_t highnib=value&0xf0;
-	uint8_t lownib=(value<<4)&0xf0;
-	write4bits((highnib)|mode);
-	write4bits((lownib)|mode);
+	uint8_t states[1 + STATES_PER_BYTE];
+	transmit(states, queue(states, value, mode, true));
+}
+
+// Queue the expander states that write a byte; returns the number of states.
+// The HD44780 latches each nibble on the falling edge of En. The first state of a transaction
+// sets RS before En rises; after that, RS doesn't change, so each nibble only needs En high and En low.
+// At 100 kHz a state takes 90 us on the bus, and at 400 kHz 22.5 us, so the enable pulse (>450 ns)
+// and the time between two bytes (>37 us) are met without delays.
+uint8_t LiquidCrystal_I2C::queue(uint8_t *states, uint8_t value, uint8_t mode, bool first) {
+	uint8_t n = 0;
+	uint8_t nibbles[2] = {(uint8_t) (value & 0xf0), (uint8_t) ((value << 4) & 0xf0)};
+	for (uint8_t i = 0; i < 2; i++) {
+		uint8_t data = nibbles[i] | mode | _backlightval;
+		if (first && i == 0) states[n++] = data;
+		states[n++] = data | En;
+		states[n++] = data & ~En;
+	}
+	return n;
+}
+
+// Write expander states in one transaction
+void LiquidCrystal_I2C::transmit(const uint8_t *states, uint8_t length) {
+	Wire.beginTransmission(_addr);
+	Wire.write(states, length);
+	Wire.endTransmission();
 }
 
 void LiquidCrystal_I2C::write4bits(uint8_t value) {
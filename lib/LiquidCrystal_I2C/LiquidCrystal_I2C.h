@@ -72,8 +72,11 @@ public:
 
 	/**
 	 * Set the LCD display in the correct begin state, must be called before anything else is done.
+	 *
+	 * @param clock		I2C bus clock in Hz. The PCF8574 is specified for 100 kHz; modules with a
+	 *					PCA8574 (or a PCF8574 that tolerates it) can use 400000.
 	 */
-	void begin();
+	void begin(uint32_t clock = 100000);
 
 	 /**
 	  * Remove all the characters currently shown. Next print/write operation will start
@@ -135,6 +138,8 @@ public:
 	void createChar(uint8_t, uint8_t[]);
 	void setCursor(uint8_t, uint8_t);
 	virtual size_t write(uint8_t);
+	virtual size_t write(const uint8_t *, size_t);
+	using Print::write;
 	void command(uint8_t);
 
 	inline void blink_on() { blink(); }
@@ -148,6 +153,10 @@ public:
 	void printstr(const char[]);
 
 private:
+	// Expander states queued per byte after the first one of a transaction
+	static const uint8_t STATES_PER_BYTE = 4;
+	uint8_t queue(uint8_t *, uint8_t, uint8_t, bool);
+	void transmit(const uint8_t *, uint8_t);
 	void send(uint8_t, uint8_t);
 	void write4bits(uint8_t);
 	void expanderWrite(uint8_t);
@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <EepromQueue.h>
+#include <Driver.h>
+#include <MazeMemory.h>
+
+// Quarter turns are computed from the values of the directions
+static_assert(Driver::LEFT == 0 && Driver::FORWARD == 1 && Driver::RIGHT == 2 && Driver::BACKWARD == 3,
+    "Directions must be in clockwise order from LEFT");
+
+// Constructor
+MazeMemory::MazeMemory(int address) {
+    this->address = address;
+    memset(&header, 0, sizeof(header));
+    memset(entries, 0, sizeof(entries));
+    position = 0;
+}
+
+// Pack entry
+uint16_t MazeMemory::pack(byte turn, uint16_t distance) {
+    return ((uint16_t) turn << 14) | min(distance, MAX_DISTANCE);
+}
+
+// Direction to quarter turns; LEFT is three right turns
+byte MazeMemory::quarters(byte direction) {
+    return (direction + 3) & 3;
+}
+
+// Quarter turns to direction
+byte MazeMemory::direction(byte quarters) {
+    return (quarters + 1) & 3;
+}
+
+// Read entry
+uint16_t MazeMemory::entry(byte i) {
+    return entries[i];
+}
+
+// Write entry; the queue skips the unchanged bytes
+void MazeMemory::store(byte i, uint16_t value) {
+    entries[i] = value;
+    EepromQueue::put(address + sizeof(Header) + i * sizeof(value), value);
+}
+
+// Write header
+void MazeMemory::save() {
+    EepromQueue::put(address, header);
+}
+
+// Load log
+void MazeMemory::begin(byte primary, byte position) {
+    EEPROM.get(address, header);
+    if (header.magic != MAGIC || header.primary != primary || header.count > MAX_ENTRIES) {
+        header.primary = primary;
+        clear();
+    }
+    EEPROM.get(address + sizeof(Header), entries);
+
+    // Resumed; the U-turn at the end of the log is pruned at the next junction as usual
+    this->position = min(position, header.count);
+    if (this->position) return;
+
+    // A U-turn is pruned together with the turn after it; until then, the turn before it may be wrong
+    if (!header.complete && header.count && (entry(header.count - 1) >> 14) == Driver::BACKWARD) {
+        header.count = (header.count >= 2) ? header.count - 2 : 0;
+        save();
+    }
+}
+
+// Clear log
+void MazeMemory::clear() {
+    header.magic = MAGIC;
+    header.count = 0;
+    header.complete = false;
+    header.finish = 0;
+    position = 0;
+    save();
+}
+
+// Replay next turn
+bool MazeMemory::next(byte &turn, bool deadEnd) {
+    if (position >= header.count) return false;
+    byte logged = entry(position) >> 14;
+    if ((logged == Driver::BACKWARD) != deadEnd) return false;
+    turn = logged;
+    position++;
+    return true;
+}
+
+// Log turn
+void MazeMemory::record(byte turn, uint16_t distance) {
+    if (position >= MAX_ENTRIES) return; // Log full; keep the path so far
+    store(position, pack(turn, distance));
+    header.count = ++position;
+    header.complete = false;
+
+    // U-turn reduction; the distance up to the first junction is kept, the dead end is dropped
+    while (header.count >= 3 && (entry(header.count - 2) >> 14) == Driver::BACKWARD) {
+        uint16_t first = entry(header.count - 3);
+        byte net = quarters(first >> 14) + 2 + quarters(turn);
+        turn = direction(net);
+        header.count -= 2;
+        store(header.count - 1, pack(turn, first & MAX_DISTANCE));
+    }
+    position = header.count;
+    save();
+}
+
+// Log end of maze
+void MazeMemory::finish(uint16_t distance) {
+    header.count = position; // Junctions past the end belong to an older path
+    header.complete = true;
+    header.finish = min(distance, MAX_DISTANCE);
+    save();
+}
+
+// Distance to next junction
+uint16_t MazeMemory::ahead() {
+    if (position < header.count) return entry(position) & MAX_DISTANCE;
+    return header.complete ? header.finish : 0;
+}
+
+// Log leads to the end
+bool MazeMemory::solved() {
+    return header.complete;
+}
+
+// Junctions passed
+byte MazeMemory::getPosition() {
+    return position;
+}
+
+// Number of entries
+byte MazeMemory::length() {
+    return header.count;
+}
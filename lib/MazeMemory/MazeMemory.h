@@ -0,0 +1,141 @@
+#ifndef MAZE_MEMORY_H
+#define MAZE_MEMORY_H
+
+#include <Arduino.h>
+
+/**
+ * Path log of the maze, kept in EEPROM so that it survives a reset.
+ * Every junction decision is logged with the distance covered since the previous junction.
+ * Dead ends are pruned as soon as they're known (U-turn reduction): a turn, a U-turn and a turn
+ * are replaced by the single turn with the same net rotation, e.g. LBR = B, LBS = R, LBL = S, SBL = R.
+ * The log then always holds the shortest path through the junctions seen so far.
+ *
+ * A run replays the log junction by junction with next(). Once the log is used up, or disagrees with the maze,
+ * the run goes back to exploring and record() continues the log from the current junction.
+ * So a retry after a reset replays the known part of the maze and only explores the rest.
+ *
+ * Turns are Driver directions: LEFT, FORWARD (straight), RIGHT and BACKWARD (U-turn).
+ * Each entry is packed in 16 bits: the turn in the top 2 bits, and the distance (mm) in the rest.
+ *
+ * The log is loaded in RAM by begin() and only read from there. Changes are queued with EepromQueue,
+ * so logging a junction never waits for the EEPROM; the owner of the queue writes them a byte at a time.
+ */
+class MazeMemory {
+private:
+    // Marks an initialized log; changed whenever the layout changes
+    const static byte MAGIC = 0xA7;
+    // Longest log; 64 junctions take 128 bytes of the 4 KB EEPROM
+    const static byte MAX_ENTRIES = 64;
+    // Longest distance that fits in an entry (mm)
+    const static uint16_t MAX_DISTANCE = 0x3FFF;
+
+    // Stored in front of the entries
+    struct Header {
+        byte magic; // MAGIC
+        byte primary; // Hand followed while exploring; a log of the other hand is discarded
+        byte count; // Number of entries
+        byte complete; // End of the maze is logged; nothing is left to explore
+        uint16_t finish; // Distance from the last junction to the end (mm)
+    } header;
+
+    int address; // EEPROM address of the header
+    byte position; // Junctions passed in this run, in terms of the log
+    uint16_t entries[MAX_ENTRIES]; // Copy of the log in EEPROM
+
+    // Packs a turn and a distance into an entry
+    static uint16_t pack(byte, uint16_t);
+
+    /**
+     * Quarter turns (clockwise) of a direction, and back. U-turns are taken as two right turns,
+     * so the net rotation of several turns is the sum of their quarter turns.
+     */
+    static byte quarters(byte);
+    static byte direction(byte);
+
+    // Reads and writes entry i
+    uint16_t entry(byte);
+    void store(byte, uint16_t);
+
+    // Queues the header; only the changed bytes are written
+    void save();
+
+public:
+    /**
+     * Constructor
+     *
+     * @param address EEPROM address of the log (default = 0)
+     */
+    MazeMemory(int = 0);
+
+    /**
+     * Loads the log from EEPROM, and starts a run from the first junction. Waits for any EEPROM write in progress.
+     * A missing or corrupted log, or a log of the other hand, is cleared.
+     * The unresolved tail of an incomplete log (a U-turn and the turn before it) is dropped.
+     * A run resumed after a reset continues from the junction it had reached, and keeps the tail.
+     *
+     * @param primary Hand followed while exploring; Driver::LEFT or Driver::RIGHT
+     * @param position Junctions passed before the reset, from getPosition() (default = 0, start of the maze)
+     */
+    void begin(byte, byte = 0);
+
+    /**
+     * Clears the log, so that the next run explores the whole maze.
+     */
+    void clear();
+
+    /**
+     * Gets the logged turn at the junction (or dead end) ahead, and moves past it.
+     * A U-turn is only logged at dead ends; a log that disagrees with what was found is not followed.
+     *
+     * @param turn Set to the logged turn
+     * @param deadEnd Whether a dead end was found instead of a junction (default = false)
+     * @return false if the log doesn't reach this point, or disagrees; the turn is then left unchanged
+     */
+    bool next(byte &, bool = false);
+
+    /**
+     * Logs a turn taken while exploring at the current junction, and prunes the log.
+     * Any entries after the junction are dropped, and the log is no longer complete.
+     *
+     * @param turn Turn taken; BACKWARD for a dead end
+     * @param distance Distance covered since the previous junction (mm)
+     */
+    void record(byte, uint16_t);
+
+    /**
+     * Logs the end of the maze. The log is complete, and the next run only replays it.
+     *
+     * @param distance Distance covered since the last junction (mm)
+     */
+    void finish(uint16_t);
+
+    /**
+     * Logged distance to the junction (or the end) ahead.
+     *
+     * @return Distance (mm); 0 if unknown
+     */
+    uint16_t ahead();
+
+    /**
+     * Checks whether the whole path through the maze is logged.
+     *
+     * @return true if the end of the maze was reached on the logged path
+     */
+    bool solved();
+
+    /**
+     * Junctions passed in this run, in terms of the log; the log is followed from this entry on.
+     *
+     * @return Position
+     */
+    byte getPosition();
+
+    /**
+     * Number of junctions in the log.
+     *
+     * @return Entries
+     */
+    byte length();
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef PID_H
+#define PID_H
+
+#include <Arduino.h>
+
+/**
+ * Fixed point PID controller, shared by the line and wall detectors.
+ * All the maths is done in integers; gains are stored in Q format, i.e., a gain g is written as g * 2^Q.
+ * The time elapsed between two updates is measured with micros(), so the integral and derivative terms
+ * stay correct even when the loop period varies (delay(), pulseIn(), turns).
+ * Time is counted in units of 1024 us (~1 ms), so kI is per (error x ms) and kD is per (error / ms).
+ *
+ * Anti-windup: the integral is clamped such that the integral term alone can never exceed the output limit.
+ * The derivative can be smoothed by a first order low pass filter.
+ *
+ * @tparam T Type of the error, gains and output (8 or 16 bit signed)
+ * @tparam Q Number of fraction bits in the gains
+ */
+template<typename T, byte Q>
+class Pid {
+private:
+    static_assert(sizeof(T) <= 2, "Error type must be 8 or 16 bit");
+    static_assert(Q < 16, "Too many fraction bits");
+
+    // Largest value that T can hold
+    const static int32_t T_MAX = (1L << (8 * sizeof(T) - 1)) - 1;
+    // Default output limit; the motor range, or the largest value of T if it's smaller (127 for 8 bit)
+    const static T DEFAULT_LIMIT = (T) ((T_MAX < 255) ? T_MAX : 255);
+    // Longest time step (us) taken into account. Longer gaps, like a blocking turn, are clamped.
+    const static uint16_t MAX_DT = 0xFFFF;
+
+    T kP, kI, kD; // Gains in Q format
+    T outMax; // Output limit; output stays within [-outMax, outMax]
+    byte dShift; // Derivative filter strength; new value is weighted 1/2^dShift. 0 means no filtering.
+
+    int32_t integral, // Sum of error x time
+        integralMax, // Integral limit (anti-windup)
+        derivative; // Filtered rate of change of error
+    uint16_t remainder; // Part of the integral below 1024 us, carried to the next update
+    T prevErr; // Stores last recorded error
+    unsigned long prevTime; // Time of the last update
+    bool started; // Whether an update was made since the last reset
+
+    // Clamp value within [-limit, limit]
+    static int32_t clamp(int32_t value, int32_t limit) {
+        return (value > limit) ? limit : (value < -limit) ? -limit : value;
+    }
+
+public:
+    /**
+     * Constructor
+     *
+     * @param p Proportional gain (Q format)
+     * @param i Integral gain (Q format)
+     * @param d Derivative gain (Q format)
+     * @param limit Output limit (default = 255, the motor range; 127 for 8 bit T)
+     * @param filter Derivative filter strength (default = 0, no filter)
+     */
+    Pid(T p = 0, T i = 0, T d = 0, T limit = DEFAULT_LIMIT, byte filter = 0) {
+        dShift = filter;
+        outMax = limit;
+        reset();
+        setTunings(p, i, d);
+    }
+
+    /**
+     * Sets the gains and recalculates the integral limit.
+     *
+     * @param p Proportional gain (Q format)
+     * @param i Integral gain (Q format)
+     * @param d Derivative gain (Q format)
+     */
+    void setTunings(T p, T i, T d) {
+        kP = p;
+        kI = i;
+        kD = d;
+        integralMax = kI ? ((int32_t) outMax << Q) / kI : 0;
+        integral = clamp(integral, integralMax);
+    }
+
+    /**
+     * Sets the output limit.
+     *
+     * @param limit Output limit
+     */
+    void setLimit(T limit) {
+        outMax = limit;
+        setTunings(kP, kI, kD);
+    }
+
+    /**
+     * Sets the derivative filter.
+     *
+     * @param filter Filter strength; 0 disables the filter
+     */
+    void setFilter(byte filter) {
+        dShift = filter;
+    }
+
+    /**
+     * Clears the integral, derivative and time history.
+     * Should be called when the controller is resumed after a pause.
+     */
+    void reset() {
+        integral = 0;
+        remainder = 0;
+        derivative = 0;
+        prevErr = 0;
+        started = false;
+    }
+
+    /**
+     * Calculates the controller output for the given error.
+     * The first update after a reset only has the proportional term.
+     *
+     * @param err Current error
+     * @return Output within [-limit, limit]
+     */
+    T update(T err) {
+        unsigned long now = micros();
+        uint16_t dt = 0;
+        if (started) {
+            unsigned long elapsed = now - prevTime;
+            dt = (elapsed > MAX_DT) ? MAX_DT : elapsed;
+        }
+        started = true;
+        prevTime = now;
+
+        if (dt) {
+            // Integral; error x time in units of 1024 us. The shift rounds down, so the part it drops
+            // is carried over; otherwise negative errors would weigh more than positive ones
+            int32_t sum = (int32_t) err * dt + remainder;
+            remainder = sum & 0x3FF;
+            integral = clamp(integral + (sum >> 10), integralMax);
+            // Derivative; change in error per 1024 us
+            int32_t rate = (((int32_t) err - prevErr) << 10) / dt;
+            derivative += (rate - derivative) >> dShift;
+            derivative = clamp(derivative, T_MAX);
+        }
+        prevErr = err;
+
+        int32_t out = (((int32_t) kP * err) >> Q)
+            + (((int32_t) kI * integral) >> Q)
+            + (((int32_t) kD * derivative) >> Q);
+        return clamp(out, outMax);
+    }
+};
+
+#endif
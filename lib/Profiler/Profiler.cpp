@@ -0,0 +1,67 @@
+#ifdef PROFILER
+
+#include <Arduino.h>
+#include <Profiler.h>
+
+Profiler::Stats Profiler::table[Profiler::ZONES][Profiler::STAGES];
+Profiler::Zone Profiler::zone = Profiler::MAZE;
+
+// Names used in the dump
+static const char *const ZONE_NAMES[] = {"maze", "wall", "distance"};
+static const char *const STAGE_NAMES[] = {"cycle", "line", "wall", "calcVolt", "drive", "lcd"};
+
+// Set current zone
+void Profiler::setZone(Zone z) {
+    zone = z;
+}
+
+// Add a measurement
+void Profiler::record(Stage stage, unsigned long us) {
+    Stats &s = table[zone][stage];
+    if (s.count == 0 || us < s.min) s.min = us;
+    if (us > s.max) s.max = us;
+    s.total += us;
+    s.count++;
+
+    // Bucket is the number of significant bits of the time
+    byte bucket = 0;
+    while (us && bucket < BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    if (s.histogram[bucket] != 0xFFFF) s.histogram[bucket]++;
+}
+
+// Print the table
+void Profiler::dump(Print &out) {
+    out.println("zone stage count min mean max | log2 histogram (us)");
+    for (byte z = 0; z < ZONES; z++)
+        for (byte st = 0; st < STAGES; st++) {
+            Stats &s = table[z][st];
+            if (!s.count) continue;
+            out.print(ZONE_NAMES[z]);
+            out.print(' ');
+            out.print(STAGE_NAMES[st]);
+            out.print(' ');
+            out.print(s.count);
+            out.print(' ');
+            out.print(s.min);
+            out.print(' ');
+            out.print(s.total / s.count);
+            out.print(' ');
+            out.print(s.max);
+            out.print(" |");
+            for (byte b = 0; b < BUCKETS; b++) {
+                out.print(' ');
+                out.print(s.histogram[b]);
+            }
+            out.println();
+        }
+}
+
+// Clear the table
+void Profiler::reset() {
+    memset(table, 0, sizeof(table));
+}
+
+#endif
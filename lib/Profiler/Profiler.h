@@ -0,0 +1,95 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/**
+ * Control loop profiler.
+ * Times the stages of every control cycle with micros(), separately for each zone.
+ * Every (zone, stage) pair records the minimum, maximum and mean time, and a histogram of the times
+ * in power of two buckets (bucket i holds times in [2^(i-1), 2^i) us).
+ * The results are kept in a static table in RAM and can be printed over Serial at the end of a run.
+ *
+ * Profiling is enabled by the PROFILER build flag. Without it, all the macros below compile to nothing.
+ *  PROFILE_ZONE(zone)       Sets the zone for the following measurements
+ *  PROFILE_SCOPE(stage)     Times the rest of the enclosing block
+ *  PROFILED(stage, expr)    Times an expression and returns its value
+ *  PROFILE_DUMP()           Prints the table over Serial
+ */
+#ifdef PROFILER
+
+#include <Arduino.h>
+
+class Profiler {
+public:
+    // Zones of the course
+    enum Zone : byte { MAZE, WALL, DISTANCE, ZONES };
+    // Stages of a control cycle; CYCLE is a whole iteration
+    enum Stage : byte { CYCLE, LINE_DETECT, WALL_DETECT, CALC_VOLT, DRIVE, LCD, STAGES };
+    // Number of histogram buckets; the last one also holds all the longer times
+    const static byte BUCKETS = 16;
+
+    /**
+     * Times a stage from construction to destruction.
+     */
+    class Scope {
+    private:
+        Stage stage;
+        unsigned long start;
+    public:
+        Scope(Stage s) : stage(s), start(micros()) {}
+        ~Scope() { record(stage, micros() - start); }
+    };
+
+    /**
+     * Sets the zone of the following measurements.
+     *
+     * @param zone Current zone
+     */
+    static void setZone(Zone);
+
+    /**
+     * Adds a measurement to the table.
+     *
+     * @param stage Measured stage
+     * @param us Time taken (us)
+     */
+    static void record(Stage, unsigned long);
+
+    /**
+     * Prints the table. One line per measured (zone, stage):
+     * zone stage count min mean max | histogram
+     *
+     * @param out Output stream
+     */
+    static void dump(Print &);
+
+    // Clears the table
+    static void reset();
+
+private:
+    struct Stats {
+        unsigned long count, min, max, total;
+        uint16_t histogram[BUCKETS]; // Saturating counts
+    };
+    static Stats table[ZONES][STAGES];
+    static Zone zone;
+};
+
+// Two levels, so that __LINE__ is expanded before pasting
+#define PROFILE_NAME(line) profileScope##line
+#define PROFILE_SCOPE_AT(stage, line) Profiler::Scope PROFILE_NAME(line)(stage)
+
+#define PROFILE_ZONE(z) Profiler::setZone(Profiler::z)
+#define PROFILE_SCOPE(stage) PROFILE_SCOPE_AT(Profiler::stage, __LINE__)
+#define PROFILED(stage, expr) ([&]() { Profiler::Scope scope(Profiler::stage); return (expr); }())
+#define PROFILE_DUMP() Profiler::dump(Serial)
+
+#else
+
+#define PROFILE_ZONE(z)
+#define PROFILE_SCOPE(stage)
+#define PROFILED(stage, expr) (expr)
+#define PROFILE_DUMP()
+
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <Scheduler.h>
+
+Scheduler::Task Scheduler::tasks[Scheduler::MAX_TASKS];
+byte Scheduler::count = 0;
+volatile uint32_t Scheduler::ticks = 0;
+
+// Tick
+ISR(TIMER2_COMPA_vect) {
+    Scheduler::tick();
+}
+
+void Scheduler::tick() {
+    ticks++;
+}
+
+// Start Timer2
+void Scheduler::begin() {
+    noInterrupts();
+    // CTC mode, clock / 64; 16 MHz / 64 / 250 = 1 kHz
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS22);
+    OCR2A = F_CPU / 64 / (1000000UL / TICK) - 1;
+    TCNT2 = 0;
+    TIMSK2 |= _BV(OCIE2A);
+    interrupts();
+}
+
+// Add task
+byte Scheduler::add(const char *name, Function function, uint16_t period, byte priority) {
+    if (count >= MAX_TASKS) return MAX_TASKS;
+    Task &t = tasks[count];
+    t.name = name;
+    t.function = function;
+    t.period = max(period, (uint16_t) 1);
+    t.priority = priority;
+    t.runs = t.misses = t.maxLatency = 0;
+    t.maxRun = 0;
+    t.enabled = false;
+    setEnabled(count, true);
+    return count++;
+}
+
+// Enable or disable task
+void Scheduler::setEnabled(byte task, bool enabled) {
+    if (task >= MAX_TASKS) return;
+    if (enabled && !tasks[task].enabled) tasks[task].release = now() + 1;
+    tasks[task].enabled = enabled;
+}
+
+// Current tick
+uint32_t Scheduler::now() {
+    noInterrupts();
+    uint32_t t = ticks;
+    interrupts();
+    return t;
+}
+
+// Run next task
+void Scheduler::run() {
+    // Released task with the highest priority; the earliest release among equals
+    uint32_t tick = now();
+    Task *next = NULL;
+    for (byte i = 0; i < count; i++) {
+        Task &t = tasks[i];
+        if (!t.enabled || (int32_t) (tick - t.release) < 0) continue;
+        if (!next || t.priority > next->priority || (t.priority == next->priority && (int32_t) (t.release - next->release) < 0))
+            next = &t;
+    }
+
+    if (!next) {
+        // Nothing to do until the next tick; interrupts are only enabled by the instruction before the sleep
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        noInterrupts();
+        if (ticks == tick) {
+            sleep_enable();
+            interrupts();
+            sleep_cpu();
+            sleep_disable();
+        }
+        interrupts();
+        return;
+    }
+
+    Task &t = *next;
+    uint16_t latency = min(tick - t.release, 0xFFFFUL);
+    if (latency > t.maxLatency) t.maxLatency = latency;
+    unsigned long start = micros();
+    t.function();
+    unsigned long took = micros() - start;
+    if (took > t.maxRun) t.maxRun = took;
+    if (t.runs != 0xFFFF) t.runs++;
+
+    // Deadline is the next release
+    uint32_t end = now();
+    t.release += t.period;
+    if ((int32_t) (end - t.release) > 0 && t.misses != 0xFFFF) t.misses++;
+    // Releases that passed while the task was late are skipped
+    while ((int32_t) (end - t.release) >= (int32_t) t.period) {
+        t.release += t.period;
+        if (t.misses != 0xFFFF) t.misses++;
+    }
+}
+
+// Deadline misses
+uint16_t Scheduler::misses(byte task) {
+    return (task < count) ? tasks[task].misses : 0;
+}
+
+// Print statistics
+void Scheduler::dump(Print &out) {
+    out.println("task period priority runs misses maxLatency maxRun");
+    for (byte i = 0; i < count; i++) {
+        Task &t = tasks[i];
+        out.print(t.name);
+        out.print(' ');
+        out.print(t.period);
+        out.print(' ');
+        out.print(t.priority);
+        out.print(' ');
+        out.print(t.runs);
+        out.print(' ');
+        out.print(t.misses);
+        out.print(' ');
+        out.print(t.maxLatency);
+        out.print(' ');
+        out.println(t.maxRun);
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+/**
+ * Cooperative run-to-completion scheduler of periodic tasks.
+ * Timer2 ticks every millisecond; a task is released every `period` ticks, and must complete before its next release.
+ * run() starts the released task with the highest priority, and runs it to completion, so tasks never preempt
+ * each other and share data without locks. Between tasks, the CPU sleeps until the next interrupt.
+ *
+ * Every task keeps its number of runs, its deadline misses (runs completed after the next release, and releases
+ * skipped because the task was a whole period late), the longest release latency (ticks) and the longest run (us).
+ * Tasks aren't preempted, so a task that runs too long delays every task released meanwhile, whatever its priority,
+ * and can make any of them miss; only the order in which the waiting tasks start follows their priorities.
+ *
+ * Timer2 is used in CTC mode, which takes PWM off pins 9 and 10.
+ */
+class Scheduler {
+public:
+    // Task body; must not block for long
+    typedef void (*Function)();
+    // Most tasks that can be added
+    const static byte MAX_TASKS = 8;
+    // Length of a tick (us)
+    const static uint16_t TICK = 1000;
+
+    /**
+     * Starts the tick. Tasks are released from the first tick on.
+     */
+    static void begin();
+
+    /**
+     * Adds a task. It is released on the next tick, and then every period.
+     *
+     * @param name Name used in dump()
+     * @param function Task body
+     * @param period Time between releases (ticks)
+     * @param priority Tasks of higher priority run first
+     * @return Index of the task; MAX_TASKS if there is no room
+     */
+    static byte add(const char *, Function, uint16_t, byte);
+
+    /**
+     * Enables or disables a task. An enabled task is released on the next tick.
+     *
+     * @param task Index of the task
+     * @param enabled Whether the task is released
+     */
+    static void setEnabled(byte, bool);
+
+    /**
+     * Runs the released task with the highest priority, if any, or sleeps until the next interrupt.
+     * Must be called in a loop.
+     */
+    static void run();
+
+    /**
+     * Ticks since begin().
+     *
+     * @return Ticks
+     */
+    static uint32_t now();
+
+    /**
+     * Deadline misses of a task.
+     *
+     * @param task Index of the task
+     * @return Misses since the task was added
+     */
+    static uint16_t misses(byte);
+
+    /**
+     * Prints the statistics of the tasks. One line per task:
+     * task period priority runs misses maxLatency(ticks) maxRun(us)
+     *
+     * @param out Output stream
+     */
+    static void dump(Print &);
+
+    // Timer2 compare interrupt handler
+    static void tick();
+
+private:
+    struct Task {
+        const char *name;
+        Function function;
+        uint16_t period; // Ticks
+        byte priority;
+        bool enabled;
+        uint32_t release; // Tick of the current release
+        uint16_t runs, misses; // Saturating counts
+        uint16_t maxLatency; // Ticks from release to start
+        unsigned long maxRun; // us
+    };
+    static Task tasks[MAX_TASKS];
+    static byte count;
+    static volatile uint32_t ticks;
+};
+
+#endif
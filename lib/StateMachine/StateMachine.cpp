@@ -0,0 +1,62 @@
+#include <Arduino.h>
+#include <StateMachine.h>
+
+StateMachine::Record StateMachine::log[StateMachine::LOG_SIZE];
+byte StateMachine::head = 0, StateMachine::length = 0;
+
+// Constructor
+StateMachine::StateMachine(byte id, const Transition *table, byte events) {
+    this->id = id;
+    this->table = table;
+    this->events = events;
+    state = 0;
+    since = 0;
+}
+
+// Enter state
+void StateMachine::enter(byte state, byte event) {
+    this->state = state;
+    since = millis();
+
+    // Overwrite the oldest record once the log is full
+    Record &r = log[head];
+    r.time = since / 10;
+    r.state = (id << 5) | (state & (MAX_STATES - 1));
+    r.event = event;
+    head = (head + 1) % LOG_SIZE;
+    if (length < LOG_SIZE) length++;
+}
+
+// Take transition
+void StateMachine::dispatch(byte event) {
+    Transition t;
+    memcpy_P(&t, &table[state * events + event], sizeof(t));
+    if (t.next != SAME) enter(t.next, event);
+    if (t.action) t.action();
+}
+
+// Current state
+byte StateMachine::getState() {
+    return state;
+}
+
+// Time in state
+unsigned long StateMachine::elapsed() {
+    return millis() - since;
+}
+
+// Print log
+void StateMachine::dumpLog(Print &out) {
+    out.println("time machine state event");
+    for (byte i = 0; i < length; i++) {
+        Record &r = log[(head + LOG_SIZE - length + i) % LOG_SIZE];
+        out.print(r.time * 10UL);
+        out.print(' ');
+        out.print(r.state >> 5);
+        out.print(' ');
+        out.print(r.state & (MAX_STATES - 1));
+        out.print(' ');
+        if (r.event == DIRECT) out.println('-');
+        else out.println(r.event);
+    }
+}
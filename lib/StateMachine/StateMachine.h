@@ -0,0 +1,100 @@
+#ifndef STATE_MACHINE_H
+#define STATE_MACHINE_H
+
+#include <Arduino.h>
+
+/**
+ * Table-driven state machine.
+ * The transitions are a table in flash, with a row per state and a column per event, so a step is one lookup.
+ * The owner senses an event on every step and passes it to dispatch(); the entry of the current state and the event
+ * gives the next state and an action. The next state is entered before the action runs, so an action may still
+ * redirect the machine with enter().
+ *
+ * All the machines share a transition log in RAM. It keeps the last LOG_SIZE state changes with their time
+ * and event, 4 bytes each, and is printed by dumpLog() for analysis after a run.
+ */
+class StateMachine {
+public:
+    // Run when a transition is taken
+    typedef void (*Action)();
+
+    // Entry of the table
+    struct Transition {
+        byte next; // Next state; SAME to stay in the state
+        Action action; // NULL for none
+    };
+
+    // Next state of a transition that stays in the state
+    const static byte SAME = 0xFF;
+    // Event logged when a state is entered directly
+    const static byte DIRECT = 0xFF;
+    // Most states of a machine; the state is packed with the machine id in the log
+    const static byte MAX_STATES = 32;
+    // Transitions kept in the log
+    const static byte LOG_SIZE = 64;
+
+    /**
+     * Constructor
+     *
+     * @param id Number of the machine in the log; 0 to 7
+     * @param table Transitions in flash; states * events entries, a row per state
+     * @param events Number of events (columns of the table)
+     */
+    StateMachine(byte, const Transition *, byte);
+
+    /**
+     * Enters a state, and logs the transition. The time in the state starts over, even if it's the current state.
+     *
+     * @param state State to enter
+     * @param event Event logged with the transition (default = DIRECT)
+     */
+    void enter(byte, byte = DIRECT);
+
+    /**
+     * Takes the transition of the current state on the event; enters its next state, then runs its action.
+     *
+     * @param event Event sensed by the owner
+     */
+    void dispatch(byte);
+
+    /**
+     * Current state.
+     *
+     * @return State
+     */
+    byte getState();
+
+    /**
+     * Time since the current state was entered.
+     *
+     * @return Time (ms)
+     */
+    unsigned long elapsed();
+
+    /**
+     * Prints the transition log, oldest first. One line per transition:
+     * time(ms) machine state event
+     * Events entered directly are printed as -.
+     *
+     * @param out Output stream
+     */
+    static void dumpLog(Print &);
+
+private:
+    const Transition *table;
+    byte events;
+    byte id;
+    byte state;
+    unsigned long since; // Time the state was entered (ms)
+
+    // Entry of the log
+    struct Record {
+        uint16_t time; // Time of the transition (10 ms); wraps after 11 minutes
+        byte state; // Machine id in the top 3 bits, and the state entered
+        byte event;
+    };
+    static Record log[LOG_SIZE];
+    static byte head, length;
+};
+
+#endif
@@ -1,80 +1,316 @@
 #include "Arduino.h"
 #include "WallDetector.h"
 
-// Constructor
-WallDetector::WallDetector(byte pins[][2], uint16_t thresh[]) {
+WallDetector *WallDetector::instance = NULL;
+
+// Echo edges; the pin change interrupts of the Mega reach the echo pins on PCINT0 and PCINT2
+ISR(PCINT0_vect) {
+    WallDetector::handleEcho();
+}
+
+ISR(PCINT2_vect) {
+    WallDetector::handleEcho();
+}
+
+// Set up the sensors
+void WallDetector::setup(byte echoes[], uint16_t thresh[]) {
     for (int i = 0; i < 3; i++) {
-        sensors[i].trig = pins[i][0];
-        sensors[i].echo = pins[i][1];
-        pinMode(sensors[i].trig, OUTPUT);
+        sensors[i].echo = echoes[i];
         pinMode(sensors[i].echo, INPUT);
+        sensors[i].input = portInputRegister(digitalPinToPort(sensors[i].echo));
+        sensors[i].mask = digitalPinToBitMask(sensors[i].echo);
+        sensors[i].mm = sensors[i].raw[0] = sensors[i].raw[1] = sensors[i].raw[2] = NO_ECHO;
+        sensors[i].head = 0;
+        sensors[i].stamp = 0;
+        sensors[i].measured = false;
+        sensors[i].maxAge = 0;
+        sensors[i].wanted = 0;
+        sensors[i].firedAt = 0;
+        sensors[i].rising = sensors[i].done = false;
+
+        // Enable the pin change interrupt of the echo pin, if it has one
+        volatile uint8_t *pcicr = digitalPinToPCICR(sensors[i].echo);
+        sensors[i].async = pcicr != NULL;
+        if (sensors[i].async) {
+            *pcicr |= _BV(digitalPinToPCICRbit(sensors[i].echo));
+            *digitalPinToPCMSK(sensors[i].echo) |= _BV(digitalPinToPCMSKbit(sensors[i].echo));
+        }
     }
+    inFlight = 0;
+    instance = this;
+
+    // Side sensors face away from each other; the front sensor may hear the pulses of both
+    for (byte i = 0; i < 3; i++) sensors[i].crosstalk = _BV(i);
+    setCrosstalk(FRONT, _BV(LEFT) | _BV(RIGHT));
     
     MIN_DIST = thresh[0];
     MAX_DIST = thresh[1];
     AVG_DIST = (MIN_DIST + MAX_DIST) / 2;
 
-    errSum = 0;
-    prevErr = 0;
+    // Echoes from beyond 1.25 MAX_DIST don't matter; mm to us is the inverse of the conversion in store()
+    echoTimeout = ECHO_DELAY + (((uint32_t) (MAX_DIST + MAX_DIST / 4) << 10) / 177);
+
+    kP2 = 0;
+
+    estimate.wall = NO_WALL;
+    odometer = NULL;
 }
 
 // Destructor
 WallDetector::~WallDetector() {}
 
-// Calculates distace from sensor
-void WallDetector::UltrasonicSensor::calcDistance() {
-    // The time it takes for the pulse to hit the wall and come back
-    unsigned long duration;
-    
+// Trigger a batch
+void WallDetector::pulse(byte batch) {
     // Throw a pulse for 10 microseconds
-    digitalWrite(trig, LOW);
+    triggers(batch, LOW);
     delayMicroseconds(5);
-    digitalWrite(trig, HIGH);
+    triggers(batch, HIGH);
     delayMicroseconds(10);
-    digitalWrite(trig, LOW);
+    triggers(batch, LOW);
+}
 
-    // Calculate distance in cm
-    duration = pulseIn(echo, HIGH);
-    
+// Calculates distace from sensor
+void WallDetector::UltrasonicSensor::calcDistance(unsigned long timeout) {
+    // The time it takes for the pulse to hit the wall and come back
+    store(pulseIn(echo, HIGH, timeout));
+}
+
+// Store a reading
+void WallDetector::UltrasonicSensor::store(unsigned long duration) {
     /* 
      * Speed of sound in air, v = 346 m/s
      * Time taken, t = 0.5(t E-6) s
-     * distance = v * t = 0.173t
+     * distance = v * t = 0.173t ~ 177t / 1024
+     */
+    raw[head] = duration ? (duration * 177) >> 10 : NO_ECHO;
+    head = (head + 1) % 3;
+    // The first reading stands for the readings before it
+    if (!measured) raw[0] = raw[1] = raw[2] = raw[(head + 2) % 3];
+
+    // Median of the last 3 readings
+    uint16_t a = raw[0], b = raw[1], c = raw[2];
+    if (a > b) { uint16_t t = a; a = b; b = t; }
+    if (b > c) b = c;
+    mm = (a > b) ? a : b;
+    stamp = millis();
+    measured = true;
+}
+
+// Echo edge interrupt
+void WallDetector::handleEcho() {
+    WallDetector *w = instance;
+    if (!w || !w->inFlight) return;
+
+    unsigned long now = micros();
+    for (byte i = 0; i < 3; i++) {
+        if (!(w->inFlight & _BV(i))) continue;
+        UltrasonicSensor &s = w->sensors[i];
+        if (*s.input & s.mask) {
+            // Rising edge; start of the echo
+            if (!s.rising) {
+                s.start = now;
+                s.rising = true;
+            }
+        } else if (s.rising && !s.done) {
+            // Falling edge; end of the echo
+            s.end = now;
+            s.done = true;
+        }
+    }
+}
+
+// Set crosstalk
+void WallDetector::setCrosstalk(byte wall, byte walls) {
+    if (wall > 2) return;
+    for (byte i = 0; i < 3; i++) {
+        if (i == wall) continue;
+        if (walls & _BV(i)) {
+            sensors[wall].crosstalk |= _BV(i);
+            sensors[i].crosstalk |= _BV(wall);
+        } else {
+            sensors[wall].crosstalk &= ~_BV(i);
+            sensors[i].crosstalk &= ~_BV(wall);
+        }
+    }
+}
+
+// Sensor may fire
+bool WallDetector::clear(byte wall, unsigned long now) {
+    if (inFlight & sensors[wall].crosstalk) return false;
+    for (byte i = 0; i < 3; i++)
+        if ((sensors[wall].crosstalk & _BV(i)) && now - sensors[i].firedAt < PING_INTERVAL) return false;
+    return true;
+}
+
+// Fire a batch
+void WallDetector::fire(byte batch, unsigned long now) {
+    for (byte i = 0; i < 3; i++)
+        if (batch & _BV(i)) {
+            UltrasonicSensor &s = sensors[i];
+            s.rising = s.done = false;
+            s.firedAt = now;
+        }
+    pulse(batch);
+    inFlight |= batch;
+}
+
+// Run the ranging engine
+void WallDetector::update() {
+    unsigned long now = micros();
+
+    // Collect the echoes of the sensors in flight
+    for (byte i = 0; i < 3; i++) {
+        if (!(inFlight & _BV(i))) continue;
+        UltrasonicSensor &s = sensors[i];
+        bool done;
+        unsigned long start, end;
+        noInterrupts();
+        done = s.done;
+        start = s.start;
+        end = s.end;
+        interrupts();
+
+        if (done) s.store(end - start);
+        else if (now - s.firedAt >= echoTimeout) s.store(0); // Nothing in range
+        else continue; // Still waiting
+        inFlight &= ~_BV(i);
+    }
+
+    /*
+     * Pick the batch: the most overdue sensor in demand first, then the most overdue of the rest that don't
+     * hear the batch. A reading takes up to an echo window to arrive, so sensors are fired that much early;
+     * companions of the batch are fired up to a slot early, since their next chance is a slot away.
      */
-    mm = duration * 0.173;
+    unsigned long ms = millis(), lead = echoTimeout / 1000 + 1;
+    byte batch = 0, heard = 0;
+    for (;;) {
+        int8_t i = -1;
+        long slack = 0;
+        for (byte j = 0; j < 3; j++) {
+            UltrasonicSensor &s = sensors[j];
+            if (!s.maxAge || ms - s.wanted > DEMAND_TIME) continue; // Not in demand
+            if ((heard & _BV(j)) || !clear(j, now)) continue;
+            if (batch && !s.async) continue; // Blocking sensors are measured alone
+            unsigned long a = age(j);
+            if (a + lead + (batch ? PING_INTERVAL / 1000 : 0) < s.maxAge) continue; // Still fresh
+            long left = (long) s.maxAge - (long) min(a, 0xFFFFUL); // Never measured is the most overdue
+            if (i < 0 || left < slack) {
+                i = j;
+                slack = left;
+            }
+        }
+        if (i < 0) break;
+        if (!sensors[i].async) {
+            // Blocking fallback
+            sensors[i].firedAt = now;
+            pulse(_BV(i));
+            sensors[i].calcDistance(echoTimeout);
+            return;
+        }
+        batch |= _BV(i);
+        heard |= sensors[i].crosstalk;
+    }
+    if (batch) fire(batch, now);
+}
+
+// Age of a reading
+unsigned long WallDetector::age(byte wall) {
+    return sensors[wall].measured ? millis() - sensors[wall].stamp : 0xFFFFFFFF;
+}
+
+// Register demand
+void WallDetector::request(byte wall, uint16_t maxAge) {
+    if (wall > 2) return;
+    UltrasonicSensor &s = sensors[wall];
+    unsigned long ms = millis();
+    // A lapsed request no longer constrains the age
+    if (!s.maxAge || ms - s.wanted > DEMAND_TIME || maxAge < s.maxAge) s.maxAge = maxAge;
+    s.wanted = ms;
+}
+
+// Check freshness
+bool WallDetector::fresh(byte wall, uint16_t maxAge) {
+    return wall <= 2 && age(wall) <= maxAge;
+}
+
+// Set odometry source
+void WallDetector::setOdometer(uint32_t (*source)()) {
+    odometer = source;
+}
+
+// Feed estimator
+void WallDetector::track(byte wall) {
+    UltrasonicSensor &s = sensors[wall];
+    if (!s.measured || s.mm >= MAX_DIST) {
+        estimate.wall = NO_WALL; // Wall lost
+        return;
+    }
+    if (estimate.wall == wall && estimate.stamp == s.stamp) return; // Reading already used
+
+    uint32_t travelled = odometer ? odometer() : 0;
+    int32_t reading = (int32_t) s.mm << 4;
+    bool restart = estimate.wall != wall || s.stamp - estimate.stamp > MAX_GAP || travelled < estimate.odometer;
+
+    if (!restart) {
+        // Predict the offset at the new position
+        uint32_t step = travelled - estimate.odometer;
+        estimate.offset += (estimate.slope * (int32_t) step) >> 8; // Q12 * mm to Q4
+        int32_t residual = reading - estimate.offset;
+        if (abs(residual) > ((int32_t) MAX_JUMP << 4)) restart = true;
+        else {
+            // Correct both by the residual; the heading only over a long enough step
+            estimate.offset += residual >> ALPHA_SHIFT;
+            if (step >= MIN_STEP) {
+                estimate.slope += ((residual << 8) / (int32_t) step) >> BETA_SHIFT;
+                estimate.slope = constrain(estimate.slope, -4096L, 4096L);
+            }
+        }
+    }
+    if (restart) {
+        estimate.wall = wall;
+        estimate.offset = reading;
+        estimate.slope = 0;
+    }
+    estimate.stamp = s.stamp;
+    estimate.odometer = travelled;
 }
 
 // Detects deviatipon from wall
-int WallDetector::detect(byte wall) {
+int WallDetector::detect(byte wall, uint16_t maxAge) {
     // Unknown wall index
     if (wall != LEFT && wall != RIGHT) return 0;
 
-    sensors[wall].calcDistance(); // Distance from given wall
-    sensors[FRONT].calcDistance(); // Distance from front wall; used in PID
+    // Distance is measured in the background
+    request(wall, maxAge);
+    update();
+    track(wall);
 
     // Extreme point
-    if (sensors[wall].mm >= MAX_DIST) return MAX_DIST;
+    if (estimate.wall == NO_WALL) return MAX_DIST;
+
+    // Deviation from center line, predicted ahead; positive when the bot is right of it
+    int32_t ahead = (estimate.offset + ((estimate.slope * LOOKAHEAD) >> 8)) >> 4;
+    int32_t deviation = ahead - AVG_DIST;
+    if (wall == RIGHT) deviation = -deviation;
+    return constrain(deviation, -(int32_t) AVG_DIST, (int32_t) MAX_DIST - 1);
+}
 
-    // Deviation from center line
-    return sensors[wall].mm - AVG_DIST;
+// Estimated offset
+int16_t WallDetector::getOffset() {
+    return estimate.offset >> 4;
+}
+
+// Estimated heading; atan(x) ~ x for small angles
+int16_t WallDetector::getHeading() {
+    return (estimate.slope * 1000) >> 12;
 }
 
 // Calculate voltage
 // ! No measures if the bot reaches MIN_DIST from wall
-int WallDetector::calcVolt(int err) {
+int WallDetector::calcVolt(int err, uint16_t maxAge) {
+    request(FRONT, maxAge);
     // A value is generated only if bot doesn't cross the average distance from front wall
     if (AVG_DIST < sensors[FRONT].mm) {
-        /*
-         * kP1: Constant of propotionality. Sets propotionality with err value.
-         * kP2: Constant of propotionality. Sets propotionality with distance from front wall. 
-         *      Responsible for slowing down bot as it approaches front wall.
-         * kI: Constant of integration. Sets integral  relation with err value.
-         * kD: Constant of differentiation. Sets differential relation with err value.
-         */
-        // TODO tune pid constants
-        int kP1 = 0, kP2 = 0, kI = 0, kD = 0,
-            P, D;
-        
         /*
          * Relatinal variable with distance from front wall.
          * If the distance from front wall is greater  than MAX_DIST, it is set to zero (ignored).
@@ -84,20 +320,26 @@ int WallDetector::calcVolt(int err) {
         int x = (sensors[FRONT].mm > MAX_DIST) ? 0 : AVG_DIST - sensors[FRONT].mm;
         
         // Standard PID caluclations
-        P = (kP1 * err) + (kP2 * x);
-        D = kD * (err - prevErr);
-        errSum += err;
-        prevErr = err;
-        return abs(P + (kI * errSum) + D);
+        int32_t volt = pid.update(err) + (((int32_t) kP2 * x) >> 8);
+        return abs(constrain(volt, -255, 255));
     } else return -1; // Wall on front, don't move
 }
 
+// Check last reading for wall
+bool WallDetector::wallInRange(byte wall) {
+    return wall <= 2 && sensors[wall].mm <= MAX_DIST;
+}
+
 // Check for wall
-bool WallDetector::hasWall(byte wall) {
+bool WallDetector::hasWall(byte wall, uint16_t maxAge) {
     // Unkown wall index
     if (wall > 2 || wall < 0) return false;
     
-    sensors[wall].calcDistance();
+    // Wait for a fresh reading; at most the echo in flight, and two pings if another sensor is more overdue
+    request(wall, maxAge);
+    unsigned long start = micros();
+    do update();
+    while (!fresh(wall, maxAge) && micros() - start < 2 * (PING_INTERVAL + echoTimeout));
     // Wall within range
     if (sensors[wall].mm <= MAX_DIST) return true;
     // No wall
@@ -1,6 +1,9 @@
 #ifndef WALL_DETECTOR_H
 #define WALL_DETECTOR_H
 
+#include <Pid.h>
+#include <FastPin.h>
+
 /**
  * WallDetector class conatins methods and attributes provide wall following functionality.
  * The class interacts with the ultrasonic sensors connected to the robot.
@@ -9,68 +12,302 @@ class WallDetector {
 private:
     /**
      * The robot conatins 3 ultrasonic sensors which are used during the wall following section.
-     * Each sensor is assiciated with a trigger pin and an echo pin.
-     * Along with the pins, the sensor also stores the last measured distance (in mm).
-     * It also contains a method to calculate distance.
+     * Each sensor is assiciated with a trigger pin and an echo pin. The trigger pins are known at compile time
+     * (see WallDetector::Triggers), and are written by WallDetector::pulse().
+     * Along with the pins, the sensor also stores the last measured distance (in mm) and the time of the measurement.
+     * The distance is the median of the last 3 readings, so a single spike or missed echo is ignored.
+     * The demand of the callers is kept too: the tightest age they accept, and until when they want it.
+     * While a ping is in flight, the echo edges are timestamped by the interrupt in the sensor itself,
+     * so any number of sensors can be timed at once.
+     * It also contains methods to fire the sensor and to calculate distance.
      */
     struct UltrasonicSensor {
-        byte trig, echo; // Trigger and echo pin
-        uint16_t mm; // Distance measured by the sensor
-        void calcDistance(); //Calculates distance of the wall from the given sensor and stores that distance in mm attribute.
+        byte echo; // Echo pin
+        volatile uint8_t *input; // Input register of the echo pin; read in the interrupt
+        uint8_t mask; // Bit of the echo pin in the input register
+        bool async; // Echo pin has a pin change interrupt
+        uint16_t mm; // Distance measured by the sensor (filtered); NO_ECHO if nothing is in range
+        uint16_t raw[3]; // Last readings
+        byte head; // Slot of the next reading in raw
+        unsigned long stamp; // Time of the measurement (ms)
+        bool measured; // Stamp is valid
+        uint16_t maxAge; // Oldest reading accepted by the callers (ms)
+        unsigned long wanted; // Time of the last request (ms)
+        byte crosstalk; // Sensors that hear the pulses of this one, itself included (bit per wall index)
+        unsigned long firedAt; // Time of the last trigger (us)
+        volatile bool rising, done; // Echo started, echo ended
+        volatile unsigned long start, end; // Edge times (us)
+        void calcDistance(unsigned long); // Times the echo of the pulse just thrown, and stores the distance in mm attribute.
+        void store(unsigned long); // Converts an echo length (us; 0 if none) to a reading and updates mm
     } sensors[3]; // Left, front and right sensor
 
-    int errSum,  // Sum of all the errors; Used in PID
-        prevErr; // Stores the last error calculated
+    /*
+     * Ranging engine.
+     * Sensors are fired by update() only on demand: a sensor is fired when a caller requested it recently,
+     * and its reading is about to get older than the caller accepts. A sensor nobody asks for is never fired.
+     * The most overdue sensor goes first, and every sensor that can't hear it (or the others of the batch)
+     * is fired with it, if it's due before the next slot. Sensors that hear each other are staggered
+     * by PING_INTERVAL; see setCrosstalk().
+     * The echo edges of all the sensors in flight are timestamped by one pin change interrupt handler,
+     * so the main loop never waits for an echo.
+     * Sensors without a pin change interrupt on the echo pin are measured alone with pulseIn() in their turn.
+     */
+    static WallDetector *instance; // Detector served by the interrupt
+    volatile byte inFlight; // Sensors waiting for their echo (bit per wall index)
+    // Time after which a missing echo is abandoned (us); covers echoes from up to RANGE_MARGIN times MAX_DIST
+    unsigned long echoTimeout;
+    // Delay between trigger and start of the echo (us)
+    const static unsigned long ECHO_DELAY = 500;
+    // Minimum time between two triggers of sensors that hear each other, so that the echoes die out (us)
+    const static unsigned long PING_INTERVAL = 20000;
+    // Time a request stays in force (ms); callers renew it on every cycle
+    const static unsigned long DEMAND_TIME = 200;
+
+    /**
+     * Age of a reading.
+     *
+     * @param wall Wall index
+     * @return Age (ms); 0xFFFFFFFF if never measured
+     */
+    unsigned long age(byte);
+
+    /**
+     * Checks whether a sensor may be fired now: it's not in flight, and the last pings of the sensors
+     * that hear each other with it have died out.
+     *
+     * @param wall Wall index
+     * @param now Current time (us)
+     * @return true if the sensor is clear to fire
+     */
+    bool clear(byte, unsigned long);
+
+    // Drives the trigger pins of a batch; generated for the trigger pins, see WallDetector::writeTriggers()
+    void (*triggers)(byte, bool);
+
+    // Drives the trigger pins L, F and R of the sensors in a batch; each write is a single instruction
+    template<byte L, byte F, byte R> static void writeTriggers(byte batch, bool high) {
+        if (batch & _BV(LEFT)) FastPin<L>::write(high);
+        if (batch & _BV(FRONT)) FastPin<F>::write(high);
+        if (batch & _BV(RIGHT)) FastPin<R>::write(high);
+    }
+
+    /**
+     * Throws a 10 us pulse on the trigger pins of a batch of sensors.
+     *
+     * @param batch Sensors to trigger (bit per wall index)
+     */
+    void pulse(byte);
+
+    /**
+     * Sets up the sensors; called by the constructor.
+     *
+     * @param echoes Echo pins of the left, front and right sensors
+     * @param thresh Minimum and maximum threshold
+     */
+    void setup(byte[], uint16_t[]);
+
+    /**
+     * Fires a batch of sensors with one shared trigger pulse, and puts them in flight.
+     *
+     * @param batch Sensors to fire (bit per wall index)
+     * @param now Current time (us)
+     */
+    void fire(byte, unsigned long);
+
+    /*
+     * Estimator of the pose relative to the followed wall: lateral offset and heading.
+     * An alpha-beta filter (a steady state Kalman filter) over the distance travelled, measured by the encoder:
+     * the offset is predicted from the heading and the distance covered since the last reading,
+     * and both are corrected by the residual of the new reading. So consecutive readings give the heading,
+     * and a single bad reading only moves the estimate part of the way.
+     * The heading is kept as a slope: change of the wall distance per distance travelled; positive when moving away.
+     * The estimate restarts from the reading when the wall changes, after a gap, or on a jump (a corner).
+     */
+    struct Estimate {
+        byte wall; // Wall tracked; NO_WALL if none
+        int32_t offset; // Distance from the wall (mm, Q4)
+        int32_t slope; // Heading (Q12; 4096 is 45 degrees)
+        unsigned long stamp; // Time of the last reading used (ms)
+        uint32_t odometer; // Odometer at the last reading (mm)
+    } estimate;
+    const static byte NO_WALL = 0xFF;
+    // Gains of the filter, as shifts: alpha = 1/2, beta = 1/8
+    const static byte ALPHA_SHIFT = 1, BETA_SHIFT = 3;
+    // Shortest travel between readings used for the heading (mm); the slope of shorter steps is only noise
+    const static uint16_t MIN_STEP = 5;
+    // Residual (mm) or gap between readings (ms) that restarts the estimate
+    const static uint16_t MAX_JUMP = 80, MAX_GAP = 500;
+    // Distance ahead at which the offset is predicted for steering (mm); damps the oscillation
+    const static uint16_t LOOKAHEAD = 300;
+    // Source of the distance travelled (mm); NULL if there is none
+    uint32_t (*odometer)();
+
+    /**
+     * Feeds the last reading of a wall to the estimator, if it's new.
+     *
+     * @param wall Wall index
+     */
+    void track(byte);
+
+    // PID controller for the deviation from the wall; gains in Q8
+    Pid<int16_t, 8> pid;
+    // Constant of propotionality with distance from front wall (Q8)
+    int16_t kP2;
 
 public:
     // Wall indices
     const static byte LEFT = 0, FRONT = 1, RIGHT = 2;
+    // Distance reported when no echo is received
+    const static uint16_t NO_ECHO = 0xFFFF;
+    // Age accepted by default (ms); about 2 cm at full speed
+    const static uint16_t MAX_AGE = 60;
     // Minimum and maximum distance allowed from the wall
     uint16_t MIN_DIST, MAX_DIST,
         AVG_DIST; // Average distance to be maintained from the wall (center line)
     
+    /**
+     * Trigger pins of the left, front and right sensors.
+     * They are given as a type, so that the trigger writes are resolved at compile time.
+     */
+    template<byte L, byte F, byte R> struct Triggers {
+        // Trigger pin of a sensor
+        static constexpr byte pin(byte wall) {
+            return (wall == LEFT) ? L : (wall == FRONT) ? F : R;
+        }
+    };
+
     /**
      * Contructor
      * Initializes senor pins and sets the mode for the respective pins.
      * Also sets the minimum and maximum threshold.
      * 
-     * @param pins (trig, echo) pin pairs for left, front and right ultrasonic sensors respectively
+     * @param triggers Trigger pins
+     * @param echoes Echo pins for left, front and right ultrasonic sensors respectively
      * @param thresh Minimum and maximum threshold, i.e., allowed distance from the wall
      */
-    WallDetector(byte[][2], uint16_t[]);
+    // kP of 0.5 per mm of the estimated deviation, found in the simulator at base volt 130
+    // TODO tune kI and kD on the bot
+    template<byte L, byte F, byte R>
+    WallDetector(Triggers<L, F, R>, byte echoes[], uint16_t thresh[]) : pid(128, 0, 0) {
+        FastPin<L>::setOutput();
+        FastPin<F>::setOutput();
+        FastPin<R>::setOutput();
+        triggers = writeTriggers<L, F, R>;
+        setup(echoes, thresh);
+    }
+
+    /**
+     * Runs the ranging engine; must be called often.
+     * Never waits for an echo: it collects a finished (or timed out) echo, or fires the most overdue sensor.
+     * Called by detect() and hasWall(), and by the zones to keep the requested readings fresh.
+     */
+    void update();
+
+    /**
+     * Asks for a sensor to be kept fresh, without reading it. The request lapses after DEMAND_TIME,
+     * so it must be renewed while the reading is needed. The tightest age of all the requests in force is used.
+     *
+     * @param wall Wall index
+     * @param maxAge Oldest reading accepted (ms)
+     */
+    void request(byte, uint16_t);
+
+    /**
+     * Checks whether a reading is recent enough.
+     *
+     * @param wall Wall index
+     * @param maxAge Oldest reading accepted (ms)
+     * @return true if measured within maxAge
+     */
+    bool fresh(byte, uint16_t);
+
+    /**
+     * Pin change interrupt handler; timestamps the echo edges of all the sensors in flight.
+     */
+    static void handleEcho();
+
+    /**
+     * Sets the sensors that pick up the pulses of a sensor. It never shares a batch with them,
+     * and is only fired PING_INTERVAL after their last ping. The relation is symmetric.
+     * By default, the side sensors face away from each other and are fired together,
+     * and the front sensor is staggered from both.
+     *
+     * @param wall Wall index
+     * @param walls Sensors that hear it (bit per wall index, e.g. 1 << FRONT)
+     */
+    void setCrosstalk(byte, byte);
+
+    /**
+     * Sets the source of the distance travelled, used by the estimator to tell the heading from the offset.
+     * Without one, the estimator only smooths the offset.
+     *
+     * @param odometer Function returning the distance travelled (mm); it may be reset, which restarts the estimate
+     */
+    void setOdometer(uint32_t (*)());
 
     /**
      * Method calculates deviation from the wall.
-     * It invokes UltrasonicSensor::calcDistance() to measuree distance of the wall from the sensor.
-     * The distance is compared with previously calculated distance, and the deviation is calculeted.
+     * It requests the wall, and feeds the last distance measured by the ranging engine to the estimator, without waiting.
+     * The deviation is the offset from the center line predicted LOOKAHEAD ahead, from the estimated offset and heading,
+     * so a bot heading back to the center line already reads a smaller deviation.
+     * It is signed by the side of the bot, whichever wall is followed: negative when the bot is left of the center line.
      * 
-     * @param wall Wall index; LEFT, FRONT or RIGHT
+     * @param wall Wall index; LEFT or RIGHT
+     * @param maxAge Oldest reading accepted (ms); the reading may be older until the engine catches up
      * @return Returns deviation if the distance is within threshold, otherwise the threshold value is returned.
      */
-    int detect(byte);
+    int detect(byte, uint16_t = MAX_AGE);
+
+    /**
+     * Estimated distance from the followed wall.
+     *
+     * @return Distance (mm)
+     */
+    int16_t getOffset();
+
+    /**
+     * Estimated heading relative to the followed wall.
+     *
+     * @return Angle (mrad, small angle approximation); positive when moving away from the wall
+     */
+    int16_t getHeading();
 
     /**
      * Calculates the analog voltage value which will be passed to the motors.
      * The value is generated the deviation, which must be caluclated using WallDetector::detect() method.
      * Valtage signal is calculeted as follows:
-     *  - Prodotionality factor is kP times the error
-     *  - Differential factor is kD times the substraction of previous error from the current error.
-     *  - Integral factor is kI times the sum of all the previous errors.
-     * The method also stores the error value in prevError.
+     *  - Prodotionality factor is kP times the error, plus kP2 times the distance to the front wall
+     *  - Differential factor is kD times the rate of change of error.
+     *  - Integral factor is kI times the sum of error over time, clamped to the output range.
+     * The shared fixed point PID controller is used, which accounts for the actual time between calls.
+     * The front wall is requested, and its last distance is used.
      * 
      * @param err Devaition of the bot with respect to the wall
+     * @param maxAge Oldest reading of the front wall accepted (ms)
      * @return Voltage to be applied to the motors
      */
-    int calcVolt(int);
+    int calcVolt(int, uint16_t = MAX_AGE);
+
+    /**
+     * Checks the last reading of a sensor for a wall, without waiting. Pair it with request() and fresh()
+     * to decide on a recent reading; a sensor never measured reads no wall.
+     *
+     * @param wall Wall index
+     * @return true if the last distance measured is within range
+     */
+    bool wallInRange(byte);
 
     /**
      * Checks if a wall is present on the given side. 
-     * Wall is confirmed if it's within the given range.
+     * Wall is confirmed if it's within the given range. Uses the last measured distance if it's fresh enough,
+     * otherwise waits for the sensor to be measured; a wait takes up to two pings (about 45 ms).
+     * Only for code that runs outside the Scheduler; tasks use wallInRange().
      * 
      * @param wall Wall index
+     * @param maxAge Oldest reading accepted (ms)
      * @return Wall status
      */
-    bool hasWall(byte);
+    bool hasWall(byte, uint16_t = MAX_AGE);
 
     // Destructor
     ~WallDetector();
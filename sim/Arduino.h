@@ -0,0 +1,121 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/**
+ * Host replacement of the Arduino core, used by the simulator (native environment).
+ * Only the parts used by the firmware are provided. Pin numbers and port registers follow the Mega2560,
+ * so the firmware runs unmodified. Every call is charged an approximate AVR execution time on the virtual clock.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define B00000001 1
+#define B00000010 2
+#define B00000100 4
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define memcpy_P memcpy
+
+// Data memory of the MCU; I/O registers live at their Mega2560 addresses
+extern volatile uint8_t simIo[0x200];
+#define _SFR_MEM8(addr) (simIo[addr])
+#define _SFR_MEM16(addr) (*(volatile uint16_t *) &simIo[addr])
+
+#define ADCSRA _SFR_MEM8(0x7A)
+#define PCICR _SFR_MEM8(0x68)
+#define PCMSK0 _SFR_MEM8(0x6B)
+#define PCMSK1 _SFR_MEM8(0x6C)
+#define PCMSK2 _SFR_MEM8(0x6D)
+
+// Timer2; compare match A is the only timer interrupt modeled
+#define TIMSK2 _SFR_MEM8(0x70)
+#define TCCR2A _SFR_MEM8(0xB0)
+#define TCCR2B _SFR_MEM8(0xB1)
+#define TCNT2 _SFR_MEM8(0xB2)
+#define OCR2A _SFR_MEM8(0xB3)
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define OCIE2A 1
+
+#define F_CPU 16000000UL
+
+// Status register; only the global interrupt flag is modeled
+#define SREG _SFR_MEM8(0x5F)
+#define SREG_I 7
+
+#define _BV(bit) (1 << (bit))
+
+// Interrupt vectors are plain functions, called by the simulator when the interrupt fires
+#define ISR(vector, ...) extern "C" void vector(void)
+void interrupts();
+void noInterrupts();
+
+// Analog pins
+static const uint8_t A0 = 54, A1 = 55, A2 = 56, A3 = 57, A4 = 58, A5 = 59, A6 = 60, A7 = 61,
+    A8 = 62, A9 = 63, A10 = 64, A11 = 65, A12 = 66, A13 = 67, A14 = 68, A15 = 69;
+
+#define NUM_DIGITAL_PINS 70
+#define NOT_A_PIN 0
+#define NOT_A_PORT 0
+
+// Pin to port mapping of the Mega2560
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t *portInputRegister(uint8_t port);
+volatile uint8_t *portModeRegister(uint8_t port);
+volatile uint8_t *portOutputRegister(uint8_t port);
+
+// Pin change interrupts; same as the Mega2560 pins_arduino.h, which only maps PCINT0 and PCINT2
+#define digitalPinToPCICR(p) ((((p) >= 10) && ((p) <= 13)) || (((p) >= 50) && ((p) <= 53)) || \
+    (((p) >= 62) && ((p) <= 69)) ? (&PCICR) : ((uint8_t *) 0))
+#define digitalPinToPCICRbit(p) ((((p) >= 62) && ((p) <= 69)) ? 2 : 0)
+#define digitalPinToPCMSK(p) ((((p) >= 10) && ((p) <= 13)) || (((p) >= 50) && ((p) <= 53)) ? (&PCMSK0) : \
+    ((((p) >= 62) && ((p) <= 69)) ? (&PCMSK2) : ((uint8_t *) 0)))
+#define digitalPinToPCMSKbit(p) ((((p) >= 10) && ((p) <= 13)) ? ((p) - 6) : (((p) >= 50) && ((p) <= 53)) ? \
+    (53 - (p)) : ((((p) >= 62) && ((p) <= 69)) ? ((p) - 62) : 0))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+
+template<class T, class L, class H>
+inline T constrain(T x, L low, H high) { return (x < low) ? low : (x > high) ? high : x; }
+template<class A, class B>
+inline A min(A a, B b) { return (b < a) ? b : a; }
+template<class A, class B>
+inline A max(A a, B b) { return (a < b) ? b : a; }
+
+#include <WString.h>
+#include <Print.h>
+#include <HardwareSerial.h>
+
+void setup();
+void loop();
+
+#endif
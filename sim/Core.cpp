@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include <FastPin.h>
+#include "Simulator.h"
+
+/*
+ * Arduino core on the simulated Mega2560.
+ * Approximate execution times of the real core at 16 MHz are charged on the virtual clock.
+ */
+
+volatile uint8_t simIo[0x200];
+
+// Ports A to L; 0 is NOT_A_PORT and there is no port I
+static const uint16_t PIN_ADDRESS[] = {0, 0x20, 0x23, 0x26, 0x29, 0x2C, 0x2F, 0x32, 0x100, 0, 0x103, 0x106, 0x109};
+enum { PA = 1, PB, PC, PD, PE, PF, PG, PH, PJ = 10, PK, PL };
+
+// Port and bit of every digital pin of the Mega2560
+static const uint8_t PIN_PORT[NUM_DIGITAL_PINS] = {
+    PE, PE, PE, PE, PG, PE, PH, PH, PH, PH, PB, PB, PB, PB, PJ, PJ, PH, PH, PD, PD, // 0-19
+    PD, PD, PA, PA, PA, PA, PA, PA, PA, PA, PC, PC, PC, PC, PC, PC, PC, PC, PD, PG, // 20-39
+    PG, PG, PL, PL, PL, PL, PL, PL, PL, PL, PB, PB, PB, PB, // 40-53
+    PF, PF, PF, PF, PF, PF, PF, PF, PK, PK, PK, PK, PK, PK, PK, PK // 54-69
+};
+static const uint8_t PIN_BIT[NUM_DIGITAL_PINS] = {
+    0, 1, 4, 5, 5, 3, 3, 4, 5, 6, 4, 5, 6, 7, 1, 0, 1, 0, 3, 2,
+    1, 0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 6, 5, 4, 3, 2, 1, 0, 7, 2,
+    1, 0, 7, 6, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7
+};
+
+uint8_t digitalPinToPort(uint8_t pin) {
+    return (pin < NUM_DIGITAL_PINS) ? PIN_PORT[pin] : NOT_A_PORT;
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin) {
+    return (pin < NUM_DIGITAL_PINS) ? (1 << PIN_BIT[pin]) : 0;
+}
+
+volatile uint8_t *portInputRegister(uint8_t port) {
+    return &simIo[PIN_ADDRESS[port]];
+}
+
+volatile uint8_t *portModeRegister(uint8_t port) {
+    return &simIo[PIN_ADDRESS[port] + 1];
+}
+
+volatile uint8_t *portOutputRegister(uint8_t port) {
+    return &simIo[PIN_ADDRESS[port] + 2];
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    sim::advance(4);
+    if (pin >= NUM_DIGITAL_PINS) return;
+    volatile uint8_t *ddr = portModeRegister(PIN_PORT[pin]);
+    if (mode == OUTPUT) *ddr |= digitalPinToBitMask(pin);
+    else *ddr &= ~digitalPinToBitMask(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    sim::advance(4);
+    if (pin >= NUM_DIGITAL_PINS) return;
+    // Disconnects the compare output of a PWM pin, like the core does
+    PinMap::Compare compare = PinMap::compare(pin);
+    if (compare.ocr) simIo[compare.timer] &= ~compare.com;
+    volatile uint8_t *port = portOutputRegister(PIN_PORT[pin]);
+    if (val) *port |= digitalPinToBitMask(pin);
+    else *port &= ~digitalPinToBitMask(pin);
+}
+
+int digitalRead(uint8_t pin) {
+    sim::advance(4);
+    if (pin >= NUM_DIGITAL_PINS) return LOW;
+    return (*portInputRegister(PIN_PORT[pin]) & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin) {
+    // 13 ADC clocks per conversion; the prescaler is set by the low bits of ADCSRA
+    uint8_t prescaler = 1 << max(ADCSRA & 0x07, 1);
+    sim::advance(13 * prescaler / 16 + 4);
+    if (pin < 16) pin += A0; // Channel number
+    return sim::analogLevel(pin);
+}
+
+void analogWrite(uint8_t pin, int val) {
+    sim::advance(6);
+    if (pin >= NUM_DIGITAL_PINS) return;
+    val = constrain(val, 0, 255);
+    // Compare output for a duty between the rails; the port bit otherwise, or on a pin without timer
+    PinMap::Compare compare = PinMap::compare(pin);
+    if (compare.ocr && val > 0 && val < 255) {
+        simIo[compare.timer] |= compare.com;
+        if (PinMap::wide(compare.timer)) _SFR_MEM16(compare.ocr) = val;
+        else simIo[compare.ocr] = val;
+        return;
+    }
+    if (compare.ocr) simIo[compare.timer] &= ~compare.com;
+    volatile uint8_t *port = portOutputRegister(PIN_PORT[pin]);
+    if (val >= 128) *port |= digitalPinToBitMask(pin);
+    else *port &= ~digitalPinToBitMask(pin);
+}
+
+uint8_t sim::outputDuty(uint8_t pin) {
+    if (pin >= NUM_DIGITAL_PINS) return 0;
+    PinMap::Compare compare = PinMap::compare(pin);
+    if (compare.ocr && (simIo[compare.timer] & compare.com)) {
+        if (!PinMap::wide(compare.timer)) return simIo[compare.ocr];
+        // TOP of the waveform generation mode of the 16 bit timer
+        uint8_t mode = (simIo[compare.timer] & 0x03) | ((simIo[compare.timer + 1] >> 1) & 0x0C);
+        uint32_t top;
+        switch (mode) {
+        case 1: case 5: top = 0xFF; break; // 8 bit, as set up by the core
+        case 2: case 6: top = 0x1FF; break;
+        case 3: case 7: top = 0x3FF; break;
+        case 8: case 10: case 14: top = _SFR_MEM16(compare.timer + 6); break; // ICRn
+        case 9: case 11: case 15: top = _SFR_MEM16(compare.timer + 8); break; // OCRnA
+        default: top = 0xFFFF; break;
+        }
+        uint32_t ocr = _SFR_MEM16(compare.ocr);
+        if (!top || ocr >= top) return 255;
+        return ocr * 255 / top;
+    }
+    return (*portOutputRegister(PIN_PORT[pin]) & digitalPinToBitMask(pin)) ? 255 : 0;
+}
+
+/********** Interrupts */
+
+// Grace period of time queries past the time limit (us)
+static const uint32_t QUERY_GRACE = 1000000;
+
+// Interrupt vectors; null unless the firmware defines them
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+extern "C" void TIMER2_COMPA_vect(void) __attribute__((weak));
+
+static bool inInterrupt = false;
+static uint8_t pcintPending, pcintLastPins[3];
+static bool timer2Pending;
+static uint64_t timer2Next; // Time of the next compare match; 0 while the timer is stopped
+
+// Time between two compare matches of Timer2 in CTC mode (us); 0 while stopped
+static uint32_t timer2Period() {
+    // Prescaler of the clock select bits
+    static const uint16_t PRESCALER[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+    uint16_t prescaler = PRESCALER[TCCR2B & 0x07];
+    if (!prescaler || !(TIMSK2 & _BV(OCIE2A))) return 0;
+    return max((OCR2A + 1UL) * prescaler / (F_CPU / 1000000UL), 1UL);
+}
+
+uint64_t sim::nextTimer() {
+    uint32_t period = timer2Period();
+    if (!period) {
+        timer2Next = 0;
+        return UINT64_MAX;
+    }
+    if (!timer2Next) timer2Next = sim::now() + period;
+    return timer2Next;
+}
+
+void interrupts() {
+    SREG |= _BV(SREG_I);
+    sim::pollInterrupts();
+}
+
+void noInterrupts() {
+    SREG &= ~_BV(SREG_I);
+}
+
+void sim::pollInterrupts() {
+    // Input registers of PCINT0 (port B) and PCINT2 (port K)
+    static const uint16_t PIN_REG[3] = {0x23, 0, 0x106}, MASK_REG[3] = {0x6B, 0x6C, 0x6D};
+    static void (*const VECTOR[3])(void) = {PCINT0_vect, NULL, PCINT2_vect};
+
+    for (uint8_t i = 0; i < 3; i += 2) {
+        uint8_t pins = simIo[PIN_REG[i]];
+        if ((PCICR & _BV(i)) && ((pins ^ pcintLastPins[i]) & simIo[MASK_REG[i]])) pcintPending |= _BV(i);
+        pcintLastPins[i] = pins;
+    }
+
+    // Compare matches that passed; a match pending already is lost, like on the MCU
+    if (sim::nextTimer() <= sim::now()) {
+        timer2Pending = true;
+        while (timer2Next <= sim::now()) timer2Next += timer2Period();
+    }
+
+    // Interrupts don't nest; pin changes come first, like the vector order of the MCU
+    if (!(SREG & _BV(SREG_I)) || inInterrupt) return;
+    inInterrupt = true;
+    for (uint8_t i = 0; i < 3; i++)
+        if (pcintPending & _BV(i)) {
+            pcintPending &= ~_BV(i);
+            sim::advance(3, QUERY_GRACE); // Entry and exit; may run inside a time query
+            if (VECTOR[i]) VECTOR[i]();
+        }
+    if (timer2Pending) {
+        timer2Pending = false;
+        sim::advance(3, QUERY_GRACE);
+        if (TIMER2_COMPA_vect) TIMER2_COMPA_vect();
+    }
+    inInterrupt = false;
+}
+
+void sleep_cpu() {
+    // Wakes up on the next timer interrupt; pin change interrupts run on the way
+    uint64_t wake = sim::nextTimer();
+    if (wake == UINT64_MAX) sim::advance(1000);
+    else sim::advance(max(wake - sim::now(), (uint64_t) 1));
+}
+
+unsigned long millis() {
+    sim::advance(1, QUERY_GRACE);
+    return sim::now() / 1000;
+}
+
+unsigned long micros() {
+    sim::advance(1, QUERY_GRACE);
+    return sim::now();
+}
+
+void delay(unsigned long ms) {
+    while (ms--) sim::advance(1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim::advance(us);
+}
+
+// Measures a pulse the same way as the Arduino core; waits for the previous pulse to end first
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+    uint64_t start = sim::now();
+    state = state ? HIGH : LOW;
+    while (sim::inputLevel(pin) == state) {
+        if (sim::now() - start >= timeout) return 0;
+        sim::advance(1);
+    }
+    while (sim::inputLevel(pin) != state) {
+        if (sim::now() - start >= timeout) return 0;
+        sim::advance(1);
+    }
+    uint64_t rise = sim::now();
+    while (sim::inputLevel(pin) == state) {
+        if (sim::now() - start >= timeout) return 0;
+        sim::advance(1);
+    }
+    return sim::now() - rise;
+}
+
+/********** EEPROM */
+
+EEPROMClass EEPROM;
+uint8_t sim::eeprom[E2END + 1];
+// End of the write in progress (us)
+static uint64_t eepromBusy = 0;
+
+int eeprom_is_ready() {
+    return sim::now() >= eepromBusy;
+}
+
+// Waits for the write in progress, like the core does before an access
+static void eepromWait() {
+    if (!eeprom_is_ready()) sim::advance(eepromBusy - sim::now());
+}
+
+uint8_t EEPROMClass::read(int address) {
+    eepromWait();
+    return sim::eeprom[address & E2END];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    eepromWait();
+    sim::eeprom[address & E2END] = value;
+    eepromBusy = sim::now() + 3300; // Erase and write
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+    if (read(address) != value) write(address, value);
+}
+
+/********** Serial */
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c) {
+    sim::advance(87); // 115200 baud
+    putchar(c);
+    return 1;
+}
+
+/********** Wire */
+
+TwoWire Wire;
+
+TwoWire::TwoWire() {
+    txLength = rxLength = rxIndex = 0;
+    clock = 100000;
+}
+
+void TwoWire::begin() {}
+
+void TwoWire::setClock(uint32_t frequency) {
+    clock = frequency;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLength >= BUFFER_LENGTH) return 0;
+    txBuffer[txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t length) {
+    size_t n = 0;
+    while (length-- && write(*data++)) n++;
+    return n;
+}
+
+uint8_t TwoWire::endTransmission(bool) {
+    // Start, address and data bytes; 9 clocks per byte
+    sim::advance((txLength + 1) * 9 * 1000000UL / clock + 10);
+    return sim::i2cWrite(txAddress, txBuffer, txLength) ? 0 : 2;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity) {
+    quantity = min(quantity, (uint8_t) BUFFER_LENGTH);
+    sim::advance((quantity + 1) * 9 * 1000000UL / clock + 10);
+    rxLength = sim::i2cRead(address, rxBuffer, quantity);
+    rxIndex = 0;
+    return rxLength;
+}
+
+int TwoWire::available() {
+    return rxLength - rxIndex;
+}
+
+int TwoWire::read() {
+    return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : -1;
+}
+
+size_t TwoWire::readBytes(char *buffer, size_t length) {
+    size_t n = 0;
+    while (n < length && rxIndex < rxLength) buffer[n++] = rxBuffer[rxIndex++];
+    return n;
+}
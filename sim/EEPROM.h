@@ -0,0 +1,40 @@
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <Arduino.h>
+
+// Last address of the EEPROM of the Mega2560 (4 KB)
+#define E2END 0xFFF
+
+/**
+ * EEPROM of the simulated board. Erased (0xFF) at the start of a run,
+ * or loaded from the image file given to the simulator, and saved back to it at the end.
+ * A write takes the 3.3 ms of a real EEPROM write in the background, like the EEPE bit of the chip:
+ * a read or write waits for the write in progress, and eeprom_is_ready() tells whether one is.
+ */
+class EEPROMClass {
+public:
+    uint8_t read(int);
+    void write(int, uint8_t);
+    void update(int, uint8_t);
+    uint16_t length() { return E2END + 1; }
+
+    template<typename T> T &get(int address, T &value) {
+        uint8_t *bytes = (uint8_t *) &value;
+        for (size_t i = 0; i < sizeof(T); i++) bytes[i] = read(address + i);
+        return value;
+    }
+
+    template<typename T> const T &put(int address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *) &value;
+        for (size_t i = 0; i < sizeof(T); i++) update(address + i, bytes[i]);
+        return value;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+// No EEPROM write in progress; from avr/eeprom.h, which the EEPROM library includes
+int eeprom_is_ready();
+
+#endif
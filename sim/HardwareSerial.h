@@ -0,0 +1,20 @@
+#ifndef SIM_HARDWARE_SERIAL_H
+#define SIM_HARDWARE_SERIAL_H
+
+#include <Print.h>
+
+/**
+ * Serial port of the simulated board. Everything written is sent to the standard output.
+ */
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    void flush() {}
+    size_t write(uint8_t);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include <Profiler.h>
+#include <EncoderProtocol.h>
+#include <Globals.h>
+#include "Simulator.h"
+
+// Pin assignment of the firmware (src/main.cpp); the IR, trigger and motor pins are given by types (include/Globals.h)
+static_assert(LineArray::SENSORS == 8, "The chassis model has 8 IR sensors");
+extern byte echo_pins[3];
+
+namespace sim {
+namespace {
+    /*
+     * Chassis model. Lengths in mm, time in s.
+     * Two driven wheels and a caster; the IR array is mounted across the front,
+     * and the ultrasonic sensors face left, front and right.
+     */
+    const double WHEEL_BASE = 150, // Distance between the driven wheels
+        MAX_SPEED = 600, // Wheel speed at full duty
+        DEAD_DUTY = 40, // Duty needed to overcome friction
+        MOTOR_LAG = 0.05, // Time constant of the motors
+        BODY_RADIUS = 110, // Radius of the chassis; used for wall contacts
+        IR_OFFSET = 80, // Distance of the IR array ahead of the wheel axle
+        IR_SPACING = 12, // Distance between two IR sensors
+        IR_SPOT = 4, // Radius of the spot seen by an IR sensor
+        SONAR_OFFSET = 60, // Distance of the ultrasonic sensors from the center
+        SONAR_RANGE = 4000, // Longest distance measured by the ultrasonic sensors
+        SOUND_SPEED = 0.343, // Speed of sound (mm/us)
+        WHEEL_DIAMETER = 70, // Wheel with the encoder (left)
+        ENCODER_TICKS = 16; // Encoder ticks per wheel rotation, both channels
+
+    const uint32_t STEP = 200, // Physics time step (us)
+        SONAR_BURST = 450, // Delay between trigger and echo (us)
+        SONAR_TIMEOUT = 38000, // Echo length when nothing is in range (us)
+        LOST_TIME = 50000; // Time without any IR sensor on line to count an off-track event (us)
+
+    const uint8_t LCD_ADDRESS = 0x27;
+
+    struct Segment {
+        double x1, y1, x2, y2, width;
+    };
+    struct Region {
+        double x1, y1, x2, y2;
+    };
+
+    // World
+    std::vector<Segment> lines, walls;
+    std::vector<Region> regions;
+
+    // State; plain data so that it is usable during static initialization of the firmware
+    bool running;
+    uint64_t simClock, lastStep, limit, lapStart;
+    double x, y, theta, // Pose of the wheel axle center
+        vLeft, vRight; // Wheel speeds (mm/s)
+    uint8_t duty[NUM_DIGITAL_PINS]; // Output duty of every pin
+    double irCoverage[8]; // Part of each IR spot covered by line
+
+    struct Sonar {
+        uint64_t rise, fall; // Echo pulse
+    } sonar[3];
+
+    // Encoder slave
+    bool encoderOn, encoderLatched;
+    double encoderTravel; // Distance covered by the encoder wheel since start (mm)
+    double encoderSpeed; // Wheel speed at the last step (mm/s)
+    uint8_t encoderSeq;
+    EncoderProtocol::Status encoderSnapshot;
+
+    // LCD (HD44780 behind a PCF8574)
+    char lcd[2][17];
+    uint8_t lcdAddress, lcdNibble, lcdLastByte;
+    bool lcdFourBit, lcdHalf;
+
+    // Statistics
+    unsigned long motorWrites, irReads, pings, offTrack, contacts, i2cBytes;
+    bool lost, lostCounted, touching;
+    uint64_t lostSince;
+    uint32_t seed = 1;
+
+    // Small deterministic noise in [-1, 1]
+    double noise() {
+        seed = seed * 1103515245 + 12345;
+        return ((seed >> 16) & 0x7FFF) / 16383.5 - 1;
+    }
+
+    // Distance of a point from a segment
+    double distance(const Segment &s, double px, double py) {
+        double dx = s.x2 - s.x1, dy = s.y2 - s.y1;
+        double len = dx * dx + dy * dy;
+        double t = len ? ((px - s.x1) * dx + (py - s.y1) * dy) / len : 0;
+        t = constrain(t, 0.0, 1.0);
+        double cx = s.x1 + t * dx - px, cy = s.y1 + t * dy - py;
+        return sqrt(cx * cx + cy * cy);
+    }
+
+    // Distance along a ray to the nearest wall
+    double castRay(double px, double py, double angle) {
+        double best = SONAR_RANGE + 1, dx = cos(angle), dy = sin(angle);
+        for (const Segment &w : walls) {
+            double ex = w.x2 - w.x1, ey = w.y2 - w.y1;
+            double den = dx * ey - dy * ex;
+            if (fabs(den) < 1e-9) continue;
+            double t = ((w.x1 - px) * ey - (w.y1 - py) * ex) / den;
+            double u = ((w.x1 - px) * dy - (w.y1 - py) * dx) / den;
+            if (t > 0 && u >= 0 && u <= 1 && t < best) best = t;
+        }
+        return best;
+    }
+
+    // Whether the bot center is inside a line following region
+    bool inRegion() {
+        for (const Region &r : regions)
+            if (x >= min(r.x1, r.x2) && x <= max(r.x1, r.x2) && y >= min(r.y1, r.y2) && y <= max(r.y1, r.y2))
+                return true;
+        return false;
+    }
+
+    // Index of the IR sensor using the pin; -1 if none
+    int irOf(uint8_t pin) {
+        for (int i = 0; i < 8; i++)
+            if (LineArray::pin(i) == pin) return i;
+        return -1;
+    }
+
+    // Sets the input register bit of a pin
+    void setInput(uint8_t pin, bool level) {
+        volatile uint8_t *reg = portInputRegister(digitalPinToPort(pin));
+        if (level) *reg |= digitalPinToBitMask(pin);
+        else *reg &= ~digitalPinToBitMask(pin);
+    }
+
+    // Wheel speed produced by a motor
+    double motorTarget(uint8_t positive, uint8_t negative) {
+        double d = (double) duty[positive] - duty[negative];
+        double magnitude = max(fabs(d) - DEAD_DUTY, 0.0) / (255 - DEAD_DUTY) * MAX_SPEED;
+        return (d < 0) ? -magnitude : magnitude;
+    }
+
+    // Moves the bot and updates the sensors by dt seconds
+    void step(double dt) {
+        vLeft += (motorTarget(LeftMotor::POSITIVE, LeftMotor::NEGATIVE) - vLeft) * dt / MOTOR_LAG;
+        vRight += (motorTarget(RightMotor::POSITIVE, RightMotor::NEGATIVE) - vRight) * dt / MOTOR_LAG;
+
+        double v = (vLeft + vRight) / 2, w = (vRight - vLeft) / WHEEL_BASE;
+        x += v * cos(theta) * dt;
+        y += v * sin(theta) * dt;
+        theta += w * dt;
+        if (encoderOn) encoderTravel += fabs(vLeft) * dt;
+        encoderSpeed = vLeft;
+
+        // IR array; sensor 0 is the leftmost
+        bool onLine = false;
+        for (int i = 0; i < 8; i++) {
+            double lateral = (3.5 - i) * IR_SPACING;
+            double sx = x + IR_OFFSET * cos(theta) - lateral * sin(theta),
+                sy = y + IR_OFFSET * sin(theta) + lateral * cos(theta);
+            double cover = 0;
+            for (const Segment &l : lines) {
+                double c = (l.width / 2 + IR_SPOT - distance(l, sx, sy)) / (2 * IR_SPOT);
+                cover = max(cover, constrain(c, 0.0, 1.0));
+            }
+            irCoverage[i] = cover;
+            setInput(LineArray::pin(i), cover < 0.5); // Sensor reads LOW on the line
+            onLine = onLine || cover >= 0.5;
+        }
+
+        // Line lost inside a line following region; counted once it lasts LOST_TIME
+        if (!onLine && lapStart && inRegion()) {
+            if (!lost) {
+                lost = true;
+                lostCounted = false;
+                lostSince = simClock;
+            } else if (!lostCounted && simClock - lostSince >= LOST_TIME) {
+                offTrack++;
+                lostCounted = true;
+            }
+        } else lost = false;
+
+        // Contacts with walls
+        bool touch = false;
+        for (const Segment &s : walls) touch = touch || distance(s, x, y) < BODY_RADIUS;
+        if (touch && !touching) contacts++;
+        touching = touch;
+    }
+
+    // Echo input of the ultrasonic sensors
+    void updateEchoes() {
+        for (int i = 0; i < 3; i++)
+            setInput(echo_pins[i], simClock >= sonar[i].rise && simClock < sonar[i].fall);
+    }
+
+    // Time of the next echo edge or timer interrupt; UINT64_MAX if none
+    uint64_t nextEdge() {
+        uint64_t edge = nextTimer();
+        for (int i = 0; i < 3; i++) {
+            if (sonar[i].rise > simClock) edge = min(edge, sonar[i].rise);
+            else if (sonar[i].fall > simClock) edge = min(edge, sonar[i].fall);
+        }
+        return edge;
+    }
+
+    // Fires an ultrasonic sensor
+    void ping(int i) {
+        static const double DIRECTION[3] = {M_PI / 2, 0, -M_PI / 2}; // Left, front, right
+        double angle = theta + DIRECTION[i];
+        double d = castRay(x + SONAR_OFFSET * cos(angle), y + SONAR_OFFSET * sin(angle), angle);
+        sonar[i].rise = simClock + SONAR_BURST;
+        sonar[i].fall = sonar[i].rise + ((d > SONAR_RANGE) ? SONAR_TIMEOUT : (uint32_t) (2 * d / SOUND_SPEED));
+        pings++;
+    }
+
+    // Takes the changes of the trigger and motor outputs since the last call
+    void sampleOutputs() {
+        for (int i = 0; i < 3; i++) {
+            uint8_t pin = SonarTriggers::pin(i), value = outputDuty(pin);
+            if (duty[pin] && !value) ping(i); // Falling edge of the trigger
+            duty[pin] = value;
+        }
+
+        const uint8_t MOTOR_PINS[4] = {LeftMotor::POSITIVE, LeftMotor::NEGATIVE, RightMotor::POSITIVE, RightMotor::NEGATIVE};
+        for (uint8_t pin : MOTOR_PINS) {
+            uint8_t value = outputDuty(pin);
+            if (value == duty[pin]) continue;
+            motorWrites++;
+            // Lap starts with the first motor command
+            if (value && !lapStart) lapStart = simClock;
+            duty[pin] = value;
+        }
+    }
+
+    // Command or data byte received by the LCD controller
+    void lcdByte(uint8_t value, bool data) {
+        if (data) {
+            int row = (lcdAddress >= 0x40) ? 1 : 0, col = lcdAddress & 0x3F;
+            if (col < 16) lcd[row][col] = value;
+            lcdAddress++;
+        } else if (value == 0x01) {
+            memset(lcd, ' ', sizeof(lcd));
+            lcd[0][16] = lcd[1][16] = '\0';
+            lcdAddress = 0;
+        } else if (value == 0x02) lcdAddress = 0;
+        else if (value & 0x80) lcdAddress = value & 0x7F;
+    }
+
+    // Output byte of the PCF8574; the HD44780 latches D4-D7 on the falling edge of En
+    void lcdExpander(uint8_t value) {
+        const uint8_t RS = 0x01, EN = 0x04;
+        if ((lcdLastByte & EN) && !(value & EN)) {
+            uint8_t nibble = lcdLastByte >> 4;
+            if (!lcdFourBit) {
+                // 8 bit mode after reset; only the function set to 4 bit mode matters
+                if (nibble == 0x2) lcdFourBit = true;
+            } else if (!lcdHalf) {
+                lcdNibble = nibble;
+                lcdHalf = true;
+            } else {
+                lcdByte((lcdNibble << 4) | nibble, lcdLastByte & RS);
+                lcdHalf = false;
+            }
+        }
+        lcdLastByte = value;
+    }
+
+    // Status of the encoder slave, counting whole ticks; the velocity is exact
+    EncoderProtocol::Status encoderStatus() {
+        double tick = M_PI * WHEEL_DIAMETER / ENCODER_TICKS;
+        EncoderProtocol::Status status;
+        status.version = EncoderProtocol::VERSION;
+        status.flags = encoderOn ? EncoderProtocol::RUNNING : 0;
+        status.ticks = (uint32_t) (encoderTravel / tick);
+        status.distance = (uint32_t) (status.ticks * tick * 16);
+        status.timestamp = (uint32_t) simClock;
+        status.velocity = encoderOn ? (int16_t) fabs(encoderSpeed) : 0;
+        return status;
+    }
+
+    // Loads the track file
+    bool load(const char *path) {
+        std::ifstream file(path);
+        if (!file) return false;
+        std::string text;
+        while (std::getline(file, text)) {
+            std::istringstream in(text.substr(0, text.find('#')));
+            std::string kind;
+            if (!(in >> kind)) continue;
+            Segment s = {0, 0, 0, 0, 30};
+            if (kind == "start") {
+                double heading = 0;
+                in >> x >> y >> heading;
+                theta = heading * M_PI / 180;
+            } else if (kind == "line") {
+                in >> s.x1 >> s.y1 >> s.x2 >> s.y2 >> s.width;
+                lines.push_back(s);
+            } else if (kind == "wall") {
+                in >> s.x1 >> s.y1 >> s.x2 >> s.y2;
+                walls.push_back(s);
+            } else if (kind == "region") {
+                Region r;
+                in >> r.x1 >> r.y1 >> r.x2 >> r.y2;
+                regions.push_back(r);
+            } else {
+                fprintf(stderr, "Unknown entry in %s: %s\n", path, text.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+uint64_t now() {
+    return simClock;
+}
+
+void advance(uint32_t us, uint32_t grace) {
+    uint64_t target = simClock + us;
+    if (!running) {
+        simClock = target;
+        return;
+    }
+    sampleOutputs();
+    while (simClock < target) {
+        simClock = min(target, nextEdge());
+        while (simClock - lastStep >= STEP) {
+            uint64_t at = simClock;
+            simClock = lastStep + STEP;
+            step(STEP / 1e6);
+            lastStep = simClock;
+            simClock = at;
+        }
+        updateEchoes();
+        pollInterrupts(); // May advance the clock further
+    }
+    if (simClock >= limit && simClock - limit >= grace) throw TimeLimit();
+}
+
+uint8_t inputLevel(uint8_t pin) {
+    if (pin >= NUM_DIGITAL_PINS) return LOW;
+    return (*portInputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+uint16_t analogLevel(uint8_t pin) {
+    int i = irOf(pin);
+    if (i < 0) return 0;
+    irReads++;
+    // Background reads high, line reads low
+    return constrain(900 - 800 * irCoverage[i] + 10 * noise(), 0.0, 1023.0);
+}
+
+bool i2cWrite(uint8_t address, const uint8_t *data, uint8_t length) {
+    i2cBytes += length;
+    if (address == LCD_ADDRESS) {
+        for (uint8_t i = 0; i < length; i++) lcdExpander(data[i]);
+        return true;
+    }
+    if (address == EncoderProtocol::ADDRESS && length) {
+        switch (data[0]) {
+            case EncoderProtocol::START: encoderOn = true; encoderTravel = 0; break;
+            case EncoderProtocol::STOP: encoderOn = false; break;
+            case EncoderProtocol::RESET: encoderTravel = 0; break;
+            case EncoderProtocol::LATCH:
+                encoderSnapshot = encoderStatus();
+                encoderSnapshot.flags |= EncoderProtocol::LATCHED;
+                encoderLatched = true;
+                break;
+        }
+        return true;
+    }
+    return false;
+}
+
+uint8_t i2cRead(uint8_t address, uint8_t *data, uint8_t length) {
+    i2cBytes += length;
+    if (address != EncoderProtocol::ADDRESS) return 0;
+    // Slave sends its status in one burst
+    EncoderProtocol::Status status = encoderLatched ? encoderSnapshot : encoderStatus();
+    encoderLatched = false;
+    status.seq = encoderSeq++;
+    EncoderProtocol::seal(status);
+    uint8_t n = min(length, (uint8_t) sizeof(status));
+    memcpy(data, &status, n);
+    return n;
+}
+}
+
+int main(int argc, char **argv) {
+    using namespace sim;
+    const char *track = (argc > 1) ? argv[1] : "sim/tracks/course.txt";
+    double seconds = (argc > 2) ? atof(argv[2]) : 300;
+    const char *image = (argc > 3) ? argv[3] : NULL;
+    if (!load(track)) {
+        fprintf(stderr, "Cannot load track %s\n", track);
+        return 1;
+    }
+
+    // Erased EEPROM, or the one left by the previous run
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    if (image) {
+        FILE *file = fopen(image, "rb");
+        if (file) {
+            if (fread(eeprom, 1, sizeof(eeprom), file) != sizeof(eeprom)) memset(eeprom, 0xFF, sizeof(eeprom));
+            fclose(file);
+        }
+    }
+
+    // Same register state as the Arduino core after init()
+    ADCSRA = 0x87;
+    // Timers 1, 3, 4 and 5 in phase correct 8 bit PWM at clock / 64, set bit by bit like init() does
+    for (uint16_t timer : {PinMap::TIMER_1, PinMap::TIMER_3, PinMap::TIMER_4, PinMap::TIMER_5}) {
+        _SFR_MEM8(timer) |= 0x01;
+        _SFR_MEM8(timer + 1) |= 0x03;
+    }
+    SREG |= _BV(SREG_I);
+    memset(lcd, ' ', sizeof(lcd));
+    lcd[0][16] = lcd[1][16] = '\0';
+    limit = simClock + (uint64_t) (seconds * 1e6);
+    lastStep = simClock;
+    running = true;
+
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    bool completed = false;
+    try {
+        setup();
+        completed = true;
+    } catch (TimeLimit &) {
+        // Timings of the unfinished run
+        limit = UINT64_MAX;
+        PROFILE_DUMP();
+    }
+    if (image) {
+        FILE *file = fopen(image, "wb");
+        if (file) {
+            fwrite(eeprom, 1, sizeof(eeprom), file);
+            fclose(file);
+        }
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    double total = simClock / 1e6, lap = lapStart ? (simClock - lapStart) / 1e6 : 0;
+    printf("Track: %s\n", track);
+    if (completed) printf("Course completed; lap time %.3f s (%.3f s since reset)\n", lap, total);
+    else printf("Time limit reached after %.3f s; position (%.0f, %.0f) mm, heading %.0f deg\n",
+        total, x, y, fmod(theta * 180 / M_PI, 360));
+    printf("Motor output changes: %.1f /s\n", lap ? motorWrites / lap : 0);
+    printf("IR analog reads: %lu, ultrasonic pings: %lu, I2C bytes: %lu\n", irReads, pings, i2cBytes);
+    printf("Off-track events: %lu, wall contacts: %lu\n", offTrack, contacts);
+    printf("LCD: |%s|\n     |%s|\n", lcd[0], lcd[1]);
+    printf("Simulated %.3f s in %.3f s (%.0fx real time)\n", total, wall, wall > 0 ? total / wall : 0);
+    return completed ? 0 : 2;
+}
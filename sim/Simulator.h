@@ -0,0 +1,89 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <Arduino.h>
+
+/**
+ * Closed loop simulator of the bot, used to benchmark the firmware on the host.
+ * The firmware (src/, lib/) is compiled unmodified against the Arduino replacement in sim/.
+ * The world contains the track and walls loaded from a file, and a kinematic model of the three-wheel chassis.
+ * All the time is virtual; it only advances when the firmware calls into the Arduino core.
+ *
+ * Usage: program [track file] [time limit in s] [EEPROM image file]
+ */
+namespace sim {
+    // Current virtual time (us)
+    uint64_t now();
+
+    /**
+     * Advances the virtual clock. Moves the bot and updates all the sensor inputs.
+     * The clock stops at every input edge and timer interrupt on the way, so that interrupts see the exact times.
+     * Stops the run by throwing TimeLimit when the time limit is reached.
+     * Time queries (micros(), millis()) may be called from destructors, so they pass a grace period
+     * and only stop the run when the limit is overrun by it.
+     *
+     * @param us Time to advance (us)
+     * @param grace Time allowed past the limit (us)
+     */
+    void advance(uint32_t us, uint32_t grace = 0);
+
+    /**
+     * Runs the pending interrupts, unless interrupts are disabled or one is already running.
+     * Called after every change of the inputs.
+     */
+    void pollInterrupts();
+
+    /**
+     * Time of the next compare match of Timer2, the only timer interrupt modeled.
+     *
+     * @return Time (us); UINT64_MAX while the timer or its interrupt is off
+     */
+    uint64_t nextTimer();
+
+    // Contents of the EEPROM (4 KB)
+    extern uint8_t eeprom[0x1000];
+
+    // Thrown when the time limit of the run is reached
+    struct TimeLimit {};
+
+    /**
+     * Level of a digital input, as seen by the sensors attached to the pin.
+     *
+     * @param pin Arduino pin number
+     * @return HIGH or LOW
+     */
+    uint8_t inputLevel(uint8_t pin);
+
+    /**
+     * Raw ADC value of an analog input.
+     *
+     * @param pin Arduino pin number
+     * @return 0 to 1023
+     */
+    uint16_t analogLevel(uint8_t pin);
+
+    /**
+     * Level driven on an output pin, from the port register or the compare output of its timer.
+     * The firmware writes the registers directly, so the simulator samples the outputs whenever the clock advances.
+     *
+     * @param pin Arduino pin number
+     * @return Duty cycle; 0 (LOW) to 255 (HIGH)
+     */
+    uint8_t outputDuty(uint8_t pin);
+
+    /**
+     * Delivers an I2C write transaction to the device at the address.
+     *
+     * @return false if no device acknowledged
+     */
+    bool i2cWrite(uint8_t address, const uint8_t *data, uint8_t length);
+
+    /**
+     * Reads bytes from the device at the address.
+     *
+     * @return Number of bytes read
+     */
+    uint8_t i2cRead(uint8_t address, uint8_t *data, uint8_t length);
+}
+
+#endif
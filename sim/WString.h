@@ -0,0 +1,28 @@
+#ifndef SIM_WSTRING_H
+#define SIM_WSTRING_H
+
+#include <string>
+
+/**
+ * Arduino String, backed by std::string.
+ */
+class String {
+private:
+    std::string value;
+
+public:
+    String(const char *s = "") : value(s) {}
+    String(const std::string &s) : value(s) {}
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+    char operator[](unsigned int i) const { return value[i]; }
+
+    String &operator+=(const String &s) { value += s.value; return *this; }
+    String operator+(const String &s) const { return String(value + s.value); }
+    bool operator==(const String &s) const { return value == s.value; }
+    bool operator!=(const String &s) const { return value != s.value; }
+    bool equals(const String &s) const { return value == s.value; }
+};
+
+#endif
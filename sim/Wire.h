@@ -0,0 +1,47 @@
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include <Arduino.h>
+
+// Size of the Wire transmit and receive buffers
+#define BUFFER_LENGTH 32
+
+/**
+ * I2C master of the simulated board.
+ * Transactions are delivered to the simulated devices, see sim::i2cWrite() and sim::i2cRead().
+ * Each transaction is charged its bus time at the configured clock.
+ */
+class TwoWire {
+private:
+    uint8_t txAddress;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLength;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t rxLength, rxIndex;
+    uint32_t clock;
+
+public:
+    TwoWire();
+    void begin();
+    void begin(uint8_t) {}
+    void setClock(uint32_t);
+    void beginTransmission(uint8_t);
+    void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+    uint8_t endTransmission(bool = true);
+    uint8_t requestFrom(uint8_t, uint8_t);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t) address, (uint8_t) quantity); }
+    size_t write(uint8_t);
+    size_t write(const uint8_t *, size_t);
+    size_t write(int data) { return write((uint8_t) data); }
+    size_t write(const char *str) { return write((const uint8_t *) str, strlen(str)); }
+    int available();
+    int read();
+    size_t readBytes(char *, size_t);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+    void onReceive(void (*)(int)) {}
+    void onRequest(void (*)()) {}
+};
+
+extern TwoWire Wire;
+
+#endif
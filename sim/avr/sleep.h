@@ -0,0 +1,14 @@
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+/**
+ * Sleep modes of the simulated MCU. Only idle sleep is modeled:
+ * sleep_cpu() advances the clock to the next timer interrupt, running the pin change interrupts on the way.
+ */
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+void sleep_cpu();
+
+#endif
@@ -1,24 +1,73 @@
 #include <Arduino.h>
 #include <Globals.h>
 #include <zones.h>
+#include <Profiler.h>
+#include <Scheduler.h>
+#include <StateMachine.h>
 
 // Initialize global objects
-byte usonic_pins[3][2] = {{0,0}, {0,0}, {0,0}};
-uint16_t dist_range[2] = {0, 0};
-WallDetector Globals::wall = WallDetector(usonic_pins, dist_range);
+// Echo pins are on PORTK (A8-A10); trigger pins are given by their type, see Globals.h
+byte echo_pins[3] = {62, 63, 64};
+uint16_t dist_range[2] = {50, 250}; // mm
+WallDetector Globals::wall = WallDetector(SonarTriggers(), echo_pins, dist_range);
 
-byte ir_pins[8] = {0,0,0,0,0,0,0,0};
-LineDetector Globals::line = LineDetector(ir_pins);
+// Pins of the array are given by its type, see Globals.h
+LineArray Globals::line = LineArray(true); // Analog mode
 
-byte motor_pins[2][2] = {{0,0}, {0,0}};
-Driver Globals::driver = Driver(motor_pins, (byte) 100);
+Driver Globals::driver = Driver(LeftMotor(), RightMotor(), (byte) 100);
 
-LiquidCrystal_I2C Globals::lcd = LiquidCrystal_I2C(0x27, 16, 2);
+// Framebuffered; the zones push it to the display with flush()
+LcdBuffer Globals::lcd = LcdBuffer(0x27, 16, 2);
+// I2C bus clock; 400000 if the LCD backpack allows it (PCA8574), the encoder slave does
+const uint32_t I2C_CLOCK = 100000;
+
+// Path log of the maze at the start of the EEPROM
+MazeMemory Globals::maze = MazeMemory(0);
+
+// Time given to sweep the line sensors across the line (ms)
+const unsigned long CALIBRATION_TIME = 3000;
+
+/**
+ * Calibrates the analog line sensors.
+ * The bot must be slid across the line while "Calibrating" is displayed,
+ * so that every sensor sees both the line and the background.
+ */
+void calibrateLine() {
+  Globals::lcd.setCursor(0, 0);
+  Globals::lcd.print("Calibrating");
+  Globals::lcd.flush();
+  Globals::line.beginCalibration();
+  unsigned long start = millis();
+  while (millis() - start < CALIBRATION_TIME)
+    Globals::line.calibrate();
+  Globals::lcd.clear();
+}
 
 void setup() {
-  byte primary = mazeSolving(Driver::LEFT);
-  wallFollowing(primary);
-  distanceMeasuring();
+  // Timings and logs are printed here at the end of the course
+  Serial.begin(115200);
+  Globals::driver.begin();
+  Globals::lcd.begin(I2C_CLOCK);
+  // A reset in the middle of the course resumes it where it stopped; a second reset while "Resuming" is shown
+  // starts the course over
+  bool resumed = resumeCourse();
+  if (!resumed) calibrateLine();
+
+  // Line sensing at 1 kHz, control at 500 Hz, sonar at 50 Hz and display at 10 Hz
+  // Sonar runs before control: its runs are short, and the pings are timed by it; control may poll the encoder for ms
+  Scheduler::add("line", lineTask, 1, 3);
+  Scheduler::add("control", controlTask, 2, 1);
+  Scheduler::add("sonar", sonarTask, 20, 2);
+  Scheduler::add("lcd", displayTask, 100, 0);
+
+  if (!resumed) startCourse(Driver::LEFT);
+  Scheduler::begin();
+  while (!courseDone()) Scheduler::run();
+
+  // Print control loop timings, deadline misses and the last zone transitions
+  PROFILE_DUMP();
+  Scheduler::dump(Serial);
+  StateMachine::dumpLog(Serial);
 }
 
 void loop() {
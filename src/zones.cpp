@@ -1,246 +1,758 @@
 #include <Arduino.h>
 #include <Wire.h>
+#include <EEPROM.h>
+#include <EepromQueue.h>
 #include <Globals.h>
 #include <zones.h>
+#include <StateMachine.h>
+#include <Profiler.h>
+
+// Time given to the display in every run of the display task (us); one or two characters at 100 kHz.
+// Well under a tick, since the line task can't start until the display task returns
+const unsigned long LCD_BUDGET = 600;
+
+// Oldest side wall reading accepted at the end of the maze (ms); the bot is slow there, and the walls are long
+const uint16_t WALL_AGE = 100;
+// Longest wait for a wall reading before the last one is taken (ms); two pings of a sensor
+const unsigned long WALL_WAIT = 60;
+
+// Time a turn of the line is seen before it's rotated for (ms); the edge of a cross-section
+// reaches the sensors a few frames apart, and reads as a turn in between
+const unsigned long TURN_CONFIRM = 30;
+
+// Base voltage of wall following; steering on the estimated pose keeps it stable above the default base volt
+const byte WALL_BASE_VOLT = 130;
+// Time driven forward before turning to the primary side (ms) TODO measure
+const unsigned long ALIGN_TIME = 500;
+
+// Extra voltage on the straights of a replayed maze path, until SLOW_DOWN before the next junction
+const int REPLAY_BOOST = 60;
+const uint16_t SLOW_DOWN = 150; // mm
+// Highest voltage passed to the driver; its base volt is added on top (100 in main.cpp)
+const int MAX_VOLT = 155;
+// Shortest time between two odometer reads on a replayed straight (ms); a read is an 18 byte I2C transaction
+const unsigned long ODOMETER_INTERVAL = 20;
+
+// Time the finish is shown before the course is done (ms); safeguard measure TODO check if necessary
+const unsigned long FINISH_TIME = 1000;
+
+// Checkpoint in EEPROM, after the maze log at 0 (134 bytes)
+const int CHECKPOINT_ADDRESS = 0x100;
+// Marks a valid checkpoint; changed whenever the layout, the states or the zones change
+const byte CHECKPOINT_MAGIC = 0x5D;
+// Time a resume waits before driving off (ms); a reset meanwhile starts the course over
+const unsigned long RESUME_WAIT = 2000;
+
+/*
+ * The course is run by controlTask() as a sequence of zones. Each zone is a StateMachine with its transitions
+ * in a table in flash: on every run, the sense function of the zone turns the inputs of the current state
+ * into an event, and the table gives the next state and the action. No state waits; a state issues a motion
+ * or a request, and senses its completion on the next runs.
+ * The line is read by lineTask() at a higher rate; its events are collected until the control task takes them.
+ * Tasks run to completion, so the state below is shared without locks.
+ */
+enum Zone : byte { MAZE, WALL, DISTANCE, END };
+static Zone zone = END;
+// Machine of the current zone
+static StateMachine *machine;
+
+// Events common to all the zones: nothing new, and the state is complete
+enum Event : byte { NONE, DONE, FIRST_EVENT };
+const byte SAME = StateMachine::SAME;
+// Entry of a table that ignores the event
+#define STAY {SAME, NULL}
+
+// Last deviation read by the line task
+static int lineErr;
+// Line events since the control task took them, and the ones taken by the current run
+static uint8_t lineEvents, events;
+// Cross-section under the array, between its debounced entered and exited events
+static bool onCrossSection;
+// Voltage computed by the sense function, applied by the actions
+static int volt;
+// Node markings counted in the zone
+static short nodeCount;
+
+// States and events of the maze
+enum MazeState : byte {
+    FOLLOW_LINE, // Line following
+    NODE_MARKING, // Crossing the first marking of a node
+    NODE_BODY, // Crossing the rest of the node
+    CROSSING, // Going straight over a junction
+    TURNING, // Rotating at a turn or junction
+    TURNING_BACK, // Rotating at a dead end until the line is found
+    CHECK_WALLS, // Cross-section after a node; waiting for the side walls
+    MAZE_STATES
+};
+enum MazeEvent : byte {
+    NODE = FIRST_EVENT, // Node entered
+    LEFT_OF_LINE, RIGHT_OF_LINE, // Deviation from the line
+    LEFT_TURN, RIGHT_TURN, // 90 degree turn of the line
+    OFF_LINE, // Dead end
+    CROSS_SECTION, // Cross-section before any node
+    JUNCTION_120, // 120 degree trisection
+    STRAIGHT, // No deviation, no junction
+    WALLS_AHEAD, // Cross-section after a node
+    LINE_FOUND, // Line found while turning back
+    NO_WALL, // No wall on either side
+    MAZE_EVENTS
+};
+static byte primaryTurn; // Hand on the wall
+static int boost; // Extra voltage on a replayed straight
+static unsigned long lastOdometer; // Time of the last odometer read on a straight (ms)
+static uint32_t segmentStart; // Odometer at the previous junction (mm)
+// Turn at the junction being taken, logged once the turn is complete; NO_TURN at other rotations
+const byte NO_TURN = 0xFF;
+static byte junctionTurn = NO_TURN;
+static bool logTurn; // Turn wasn't replayed from the log
+static uint16_t junctionDistance; // Distance covered up to the junction (mm)
+static byte wallSide; // Wall found at the end of the maze
+static unsigned long turnSince; // Time the turn under the array was first seen (ms)
+static bool turnSeen; // A turn is under the array
+
+// States and events of wall following
+enum WallState : byte {
+    PRIME, // Waiting for the first reading of the primary wall
+    FOLLOW_WALL, // Wall following
+    WALL_LOST, // No wall on the primary side; waiting for the opposite wall
+    ALIGN, // Moving forward before turning to the primary side
+    TURN_SIDE, // Turning to the primary side
+    SEEK, // Moving forward until the primary wall is in range
+    TURN_FRONT, // Wall on front; turning opposite to the primary side
+    WALL_STATES
+};
+enum WallEvent : byte {
+    LEFT_OF_CENTER = FIRST_EVENT, RIGHT_OF_CENTER, CENTERED, // Deviation from the center line
+    WALL_ENDS, // No wall on the primary side
+    FRONT_WALL, // Wall on front
+    OTHER_WALL, // Wall on the opposite side
+    LINE_AHEAD, // Cross-section at the end of the section
+    CORNER, // No wall, no line
+    WALL_EVENTS
+};
+static byte primaryWall; // Side of the wall followed
+static byte savedBaseVolt; // Base volt of the driver outside wall following
+
+// States and events of distance measuring
+enum DistanceState : byte {
+    MEASURE, // Line following over the nodes; the encoder runs from the first node
+    TO_FINISH, // Line following to the finish line
+    FINISHED, // Showing the result
+    DISTANCE_STATES
+};
+enum DistanceEvent : byte {
+    MARKING = FIRST_EVENT, // Node marking entered
+    FIRST_MARKING, LAST_MARKING, // First marking of the first node, and of the second node
+    FINISH_LINE, // Cross-section at the end
+    DISTANCE_EVENTS
+};
+
+// Zones started by the actions
+static void startWallFollowing(byte);
+static void startDistanceMeasuring();
+
+/**
+ * Distance covered by the encoder wheel since the encoder was started.
+ * Rotations are counted too, so the distance between junctions is measured from the end of a turn.
+ *
+ * @return Distance (mm); the last known distance if the Slave didn't answer
+ */
+uint32_t odometer() {
+    PROFILED(DRIVE, Globals::driver.readEncoder());
+    return Globals::driver.getEncoderStatus().distance >> 4;
+}
 
 /**
- * Invoked when a node is found.
- * Method finds the node type, prints the node details and drives the bot until the node is crossed.
- * The following data is printed:
+ * Checks for a wall without waiting. The wall is requested, and decided once its reading is fresh,
+ * or from the last reading when WALL_WAIT has passed since the state was entered.
+ *
+ * @param wall Wall index
+ * @param maxAge Oldest reading accepted (ms)
+ * @return 1 if there is a wall, 0 if not, -1 while the reading is pending
+ */
+static int8_t checkWall(byte wall, uint16_t maxAge) {
+    Globals::wall.request(wall, maxAge);
+    if (!Globals::wall.fresh(wall, maxAge) && machine->elapsed() < WALL_WAIT) return -1;
+    return Globals::wall.wallInRange(wall) ? 1 : 0;
+}
+
+// Section 1: Maze solving and node detection
+
+// Node found; move at base volt until the first marking is crossed
+static void startNode() {
+    nodeCount++;
+    PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, 0));
+}
+
+/*
+ * Every node has a marking at both its edges, and the node type is decided by the section in between.
+ * The following data is printed once the first marking is crossed:
  *  Node: <node count>
  *  Type: <node type>
- * 
- * @param nodeCount Current number of nodes found
  */
-void printNode(int nodeCount) {
-    String nodeType;
-    // Move until center of node is reached
-    do {
-        Globals::driver.move(Driver::FORWARD, 0); // Move at base volt
-        Globals::line.detect(); // Updates sensor data
-    }while (!Globals::line.isNode());
-    
-    // Print count and type
-    nodeType = Globals::line.nodeType();
-    Globals::lcd.setCursor(6, 0);
-    Globals::lcd.print(nodeCount);
-    Globals::lcd.setCursor(6, 1);
-    Globals::lcd.print(nodeType);
-
-    // Move to cross rest of the node
-    delay(2000); // Reach last rwo of the node
-    do {
-        Globals::driver.move(Driver::FORWARD, 0);
-        Globals::line.detect();
-    }while (!Globals::line.isNode()); // Move forward until node is crossed
+static void printNode() {
+    PROFILED(LCD, Globals::lcd.setCursor(6, 0));
+    PROFILED(LCD, Globals::lcd.print(nodeCount));
+    PROFILED(LCD, Globals::lcd.setCursor(6, 1));
+    PROFILED(LCD, Globals::lcd.print(Globals::line.nodeType()));
 }
 
-// Section 1: Maze solving and node detection
-short mazeSolving(short primaryTurn) {
-    int err, volt;
-    short nodeCount = 0, // Nodes encountered
-        //primaryTurn = Driver::LEFT, // Hand to be on the wall
-        wallSide = -1; // Wall index at the end of section
-    String nodeType; // "TRUE" or "FALSE"
+// Deviation to left; move to right
+static void steerRight() {
+    PROFILED(DRIVE, Globals::driver.drive(Driver::RIGHT, volt));
+}
 
-    // Initialize diplay
-    Globals::lcd.setCursor(0,0);
-    Globals::lcd.print("Node: ");
-    Globals::lcd.setCursor(0,1);
-    Globals::lcd.print("Type: ");
-
-    do {
-        // Get line data
-        err = Globals::line.detect();
-        volt = Globals::line.calcVolt(err);
-
-        // TODO align axis of rotation before rotating
-        
-        // Bot deviating to left
-        if (err < 0) {
-            // Bot is at a 90 degree turn, rotate right
-            if (Globals::line.is90Turn()) Globals::driver.move(Driver::RIGHT, volt, 90);
-            // Not a hard turn
-            else Globals::driver.move(Driver::RIGHT, volt, 90);
-        } 
-        // Bot deviating to right
-        else if (err > 0) {
-            // Bot is at a 90 degree turn, rotate left
-            if (Globals::line.is90Turn()) Globals::driver.move(Driver::LEFT, volt, 90);
-            // Not a hard turn
-            else Globals::driver.move(Driver::LEFT, volt, 90);
-        }
-        /*
-        No deviation, one of the following situations are possible:
-            - Bot is off line: Wrong trun taken, turn around
-            - Bot is on cross-section:
-                - End of section is reached: Set wallSide and return from method
-                - Normal cross-section: Turn to primanry side
-            - Bot is on a 120 degree trisection: Turn to primary side
-            - Bot is on a node: Cross the node, increase counter and display node type
-        */
-        else {
-            if (Globals::line.isOffLine()) {
-                Globals::driver.move(primaryTurn, 0, 180); // Rotate 180 degrees at base volt
-            }
-            // Cross-section
-            else if (Globals::line.isCrossSection()) {
-                // At least one node is present
-                if (nodeCount > 0) {
-                    // Check for left wall
-                    if (Globals::wall.hasWall(WallDetector::LEFT)) wallSide = WallDetector::LEFT;
-                    // Check for right wall
-                    else if (Globals::wall.hasWall(WallDetector::RIGHT)) wallSide = WallDetector::RIGHT;
-                }
-                // No wall, turn to primary side
-                else Globals::driver.move(primaryTurn, volt, 90);
-            }
-            // 120 degree trisection
-            else if (Globals::line.is120Junction()) Globals::driver.move(primaryTurn, volt, 60);
-            // Node found
-            else if (Globals::line.isNode()) {
-                nodeCount++;
-                printNode(nodeCount); 
-            }
-            // NOTA; keep moving forward
-            else Globals::driver.move(Driver::FORWARD, volt);
-        }
-    } while (wallSide == -1); // Loop until wall is found
+// Deviation to right; move to left
+static void steerLeft() {
+    PROFILED(DRIVE, Globals::driver.drive(Driver::LEFT, volt));
+}
 
-    // Clear display
-    Globals::lcd.clear();
+// TODO align axis of rotation before rotating
+// Line turns to the right; rotate right
+static void turnRight() {
+    PROFILED(DRIVE, Globals::driver.rotate(Driver::RIGHT, volt, 90));
+}
 
-    return wallSide;
+// Line turns to the left; rotate left
+static void turnLeft() {
+    PROFILED(DRIVE, Globals::driver.rotate(Driver::LEFT, volt, 90));
 }
 
+// Off line; a wrong turn was taken. The maze memory prunes the dead end once the next junction is logged
+static void turnBack() {
+    junctionDistance = odometer() - segmentStart;
+    byte turn;
+    logTurn = !Globals::maze.next(turn, true);
+    junctionTurn = Driver::BACKWARD;
+
+    // Rotate up to 180 degrees at base volt; stopped as soon as the line is found again
+    PROFILED(DRIVE, Globals::driver.rotate(primaryTurn, 0, 180));
+}
+
+/**
+ * Invoked at a maze junction. Takes the logged turn if the maze memory has one, the primary turn otherwise.
+ * Going straight drives until the junction is crossed. The turn is logged by endJunction() once it's complete.
+ *
+ * @param angle Angle of a turn at this junction
+ */
+static void takeJunction(byte angle) {
+    junctionDistance = odometer() - segmentStart;
+    byte turn = primaryTurn;
+    logTurn = !Globals::maze.next(turn);
+    junctionTurn = turn;
+
+    if (turn == Driver::FORWARD) {
+        PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, volt));
+        machine->enter(CROSSING);
+    } else PROFILED(DRIVE, Globals::driver.rotate(turn, volt, angle));
+}
+
+// Cross-section; turn to primary side (or as logged)
+static void takeCrossSection() {
+    takeJunction(90);
+}
+
+// 120 degree trisection; its branches are logged as left and right
+static void takeTrisection() {
+    takeJunction(60);
+}
+
+// Logs the junction just taken, if any, and starts the next segment; the log is written to EEPROM later
+static void endJunction() {
+    if (junctionTurn == NO_TURN) return;
+    if (logTurn) Globals::maze.record(junctionTurn, junctionDistance);
+    segmentStart = odometer();
+    junctionTurn = NO_TURN;
+}
+
+// Line found while turning back
+static void stopTurn() {
+    PROFILED(DRIVE, Globals::driver.cancel());
+    endJunction();
+}
+
+// NOTA; keep moving forward, faster on a replayed path until the next junction is near
+static void driveStraight() {
+    uint16_t ahead = Globals::maze.ahead();
+    if (!ahead) boost = 0;
+    else if (millis() - lastOdometer >= ODOMETER_INTERVAL) {
+        lastOdometer = millis();
+        boost = (odometer() - segmentStart + SLOW_DOWN < ahead) ? REPLAY_BOOST : 0;
+    }
+    PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, min(volt + boost, MAX_VOLT)));
+}
+
+// End of section; the path is complete, and the next run replays it
+static void finishMaze() {
+    Globals::maze.finish(odometer() - segmentStart);
+    // Clear display
+    PROFILED(LCD, Globals::lcd.clear());
+    startWallFollowing(wallSide);
+}
+
+/*
+ * Transitions of the maze.
+ * No deviation at a node marking or a cross-section, one of the following situations are possible:
+ *  - Bot is off line: Wrong turn taken, turn around
+ *  - Bot is on cross-section:
+ *      - End of section is reached: A wall is found on one side
+ *      - Normal cross-section: Turn to primary side
+ *  - Bot is on a 120 degree trisection: Turn to primary side
+ */
+const StateMachine::Transition MAZE_TABLE[MAZE_STATES][MAZE_EVENTS] PROGMEM = {
+    // NONE, DONE, NODE, LEFT_OF_LINE, RIGHT_OF_LINE, LEFT_TURN, RIGHT_TURN, OFF_LINE,
+    // CROSS_SECTION, JUNCTION_120, STRAIGHT, WALLS_AHEAD, LINE_FOUND, NO_WALL
+    /* FOLLOW_LINE */ {STAY, STAY, {NODE_MARKING, startNode}, {SAME, steerRight}, {SAME, steerLeft},
+        {TURNING, turnLeft}, {TURNING, turnRight}, {TURNING_BACK, turnBack},
+        {TURNING, takeCrossSection}, {TURNING, takeTrisection}, {SAME, driveStraight}, {CHECK_WALLS, NULL}, STAY, STAY},
+    /* NODE_MARKING */ {STAY, {NODE_BODY, printNode}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* NODE_BODY */ {STAY, {FOLLOW_LINE, NULL}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* CROSSING */ {STAY, {FOLLOW_LINE, endJunction}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* TURNING */ {STAY, {FOLLOW_LINE, endJunction}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* TURNING_BACK */ {STAY, {FOLLOW_LINE, endJunction}, STAY, STAY, STAY, STAY, STAY, STAY,
+        STAY, STAY, STAY, STAY, {FOLLOW_LINE, stopTurn}, STAY},
+    /* CHECK_WALLS */ {STAY, {SAME, finishMaze}, STAY, STAY, STAY, STAY, STAY, STAY,
+        STAY, STAY, STAY, STAY, STAY, {FOLLOW_LINE, NULL}}
+};
+
 // Section 2: Wall following with wall switching
-void wallFollowing(byte primary) {
-    int err, volt;
-    bool completed = false;
-    do {
-        err = Globals::wall.detect(primary);
-        volt = Globals::wall.calcVolt(err);
-        
-        if (err == Globals::wall.MAX_DIST) {
-            /*
-             * No wall on primary side. It can be due to either one of the three conditions:
-             *  - Wall switched: Wall present on the opposite side of primary
-             *  - End of section reached: Determined by presence of line
-             *  - Turn on the primary side: If the above two fails, rotate bot to primary side
-             */
-            Globals::driver.stop();
-
-            // Check for wall on opposite side
-            byte side = (primary == Globals::wall.LEFT) ? Globals::wall.RIGHT : Globals::wall.LEFT;
-            if (Globals::wall.detect(side) <= Globals::wall.MAX_DIST) {
-                // Wall on opposite side present
-                // Switch primary wall
-                primary = side;
-            }
-            // No wall on opposite side; check for line
-            else if (Globals::line.detect() == 0 && Globals::line.isCrossSection()) {
-                // Line found
-                // Set completed flag
-                completed = true; // Section complete
-            }
-            // No wall, no line; turn on primary side
-            else {
-                // Move forward to properly align after turning
-                Globals::driver.move(Globals::driver.FORWARD, 0); // Move with base volt
-                // TODO measure delay
-                delay(500);
-                
-                byte turn = (primary == Globals::wall.LEFT) ? Globals::driver.RIGHT : Globals::driver.LEFT;
-                Globals::driver.move(turn, 0, 90); // Rotate with base volt
-
-                // Move to get wall on the side
-                Globals::driver.move(Globals::driver.FORWARD, 0); // Move with base volt
-                while (Globals::wall.detect(primary) >= Globals::wall.MAX_DIST) delay(200);
-                Globals::driver.stop(); // Wall reached; contuinue in next iteration
-            }
-        } else if (volt == -1) {
-            // Wall on front
-            // Turn opposite to primary
-            byte turn = (primary == Globals::wall.LEFT) ? Globals::driver.RIGHT : Globals::driver.LEFT;
-            Globals::driver.move(turn, volt, 90); // Rotate by 90 degrees
-        } else {
-            // Move bot
-            if (err < 0) {
-                // Deviation to left
-                // Move to right
-                Globals::driver.move(Globals::driver.RIGHT, volt);
-            } else if (err > 0) {
-                // Deviation to right
-                // Move to left
-                Globals::driver.move(Globals::driver.LEFT, volt);
-            } else  {
-                // No deviation
-                // Move forward
-                Globals::driver.move(Globals::driver.FORWARD, volt);
-            }
-        }
-    } while(!completed);
+
+// No deviation; move forward
+static void driveOn() {
+    PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, volt));
+}
+
+static void stopMotors() {
+    PROFILED(DRIVE, Globals::driver.stop());
+}
+
+// Turns are taken with the wheel opposite to the primary wall, at base volt
+static void turnAway() {
+    byte turn = (primaryWall == WallDetector::LEFT) ? Driver::RIGHT : Driver::LEFT;
+    PROFILED(DRIVE, Globals::driver.rotate(turn, 0, 90)); // Rotate by 90 degrees
 }
 
+// Wall on opposite side present; switch primary wall
+static void switchWall() {
+    primaryWall = (primaryWall == WallDetector::LEFT) ? WallDetector::RIGHT : WallDetector::LEFT;
+}
+
+// Line found; section complete
+static void finishWall() {
+    Globals::driver.setBaseVolt(savedBaseVolt);
+    startDistanceMeasuring();
+}
+
+// Move forward to properly align before turning
+static void align() {
+    PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, 0, ALIGN_TIME)); // Move with base volt
+}
+
+// Move to get wall on the side
+static void seekWall() {
+    PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, 0)); // Move with base volt
+}
+
+/*
+ * Transitions of wall following.
+ * No wall on primary side can be due to either one of the three conditions:
+ *  - Wall switched: Wall present on the opposite side of primary
+ *  - End of section reached: Determined by presence of line
+ *  - Turn on the primary side: If the above two fails, rotate bot to primary side
+ */
+const StateMachine::Transition WALL_TABLE[WALL_STATES][WALL_EVENTS] PROGMEM = {
+    // NONE, DONE, LEFT_OF_CENTER, RIGHT_OF_CENTER, CENTERED, WALL_ENDS, FRONT_WALL, OTHER_WALL, LINE_AHEAD, CORNER
+    /* PRIME */ {STAY, {FOLLOW_WALL, NULL}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* FOLLOW_WALL */ {STAY, STAY, {SAME, steerRight}, {SAME, steerLeft}, {SAME, driveOn}, {WALL_LOST, stopMotors},
+        {TURN_FRONT, turnAway}, STAY, STAY, STAY},
+    /* WALL_LOST */ {STAY, STAY, STAY, STAY, STAY, STAY, STAY, {FOLLOW_WALL, switchWall}, {SAME, finishWall}, {ALIGN, align}},
+    /* ALIGN */ {STAY, {TURN_SIDE, turnAway}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* TURN_SIDE */ {STAY, {SEEK, seekWall}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* SEEK */ {STAY, {FOLLOW_WALL, stopMotors}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY},
+    /* TURN_FRONT */ {STAY, {FOLLOW_WALL, NULL}, STAY, STAY, STAY, STAY, STAY, STAY, STAY, STAY}
+};
+
 // Section 3: Measure distance between nodes
-void distanceMeasuring() {
-    int err, volt;
-    // Number of nodes encountered
-    short nodeCount = 0;
-    
-    // Do line following until two nodes are crosses
-    // This part only contains a straight line to be followed; with two TRUE nodes in between
-    do {
-        // Line Following
-        err = Globals::line.detect();
-        volt = Globals::line.calcVolt(err);
-        if (err < 0) Globals::driver.move(Driver::RIGHT, volt);
-        else if (err > 0) Globals::driver.move(Driver::LEFT, volt);
-        else Globals::driver.move(Driver::FORWARD, volt);
-        
-        // Check for node
-        if (Globals::line.isNode()) {
-            nodeCount++;
-            // First node detected
-            if (nodeCount == 1) {
-                Globals::driver.stop(); // Move after inilizing encoder
-                Globals::driver.initEncoder(); // Initialize encoder to calculate distance
-            }
-        }
-    } while (nodeCount != 3);
-    // Since the edge pattern of the node is matched, nodeCount will be 2 after crossing one node.
-    // When bot reaches the second node, nodeCount will be 3.
-    
-    // Print distance
-    Globals::driver.stop(); // Don't move or distance will be affected.
-    Globals::lcd.setCursor(0, 0);
-    Globals::lcd.print("Distance:");
-    Globals::lcd.print(Globals::driver.getDistanceTravelled(), 2);
-    Globals::lcd.print("cm");
+
+// Line Following
+static void steer() {
+    if (lineErr < 0) PROFILED(DRIVE, Globals::driver.drive(Driver::RIGHT, volt));
+    else if (lineErr > 0) PROFILED(DRIVE, Globals::driver.drive(Driver::LEFT, volt));
+    else PROFILED(DRIVE, Globals::driver.drive(Driver::FORWARD, volt));
+}
+
+static void countMarking() {
+    steer();
+    nodeCount++;
+}
+
+// First node detected; initialize encoder to calculate distance
+static void startMeasuring() {
+    countMarking();
+    PROFILED(DRIVE, Globals::driver.stop()); // Move after inilizing encoder
+    Globals::driver.initEncoder();
+}
+
+// Second node reached; print distance
+static void showDistance() {
+    nodeCount++;
+    PROFILED(DRIVE, Globals::driver.stop()); // Don't move or distance will be affected.
+    PROFILED(LCD, Globals::lcd.setCursor(0, 0));
+    PROFILED(LCD, Globals::lcd.print("Distance:"));
+    PROFILED(LCD, Globals::lcd.print(Globals::driver.getDistanceTravelled(), 2));
+    PROFILED(LCD, Globals::lcd.print("cm"));
     Globals::driver.stopEncoder(); // Stop encoder
+}
 
+// Finish line reached
+static void showFinish() {
+    PROFILED(DRIVE, Globals::driver.stop());
+    PROFILED(LCD, Globals::lcd.setCursor(0,1));
+    PROFILED(LCD, Globals::lcd.print("FINISH"));
+}
 
-    //Drive to finish line
-    bool crossSection = false;
-    do {
-        // Line Following
-        err = Globals::line.detect();
-        volt = Globals::line.calcVolt(err);
-        if (err < 0) Globals::driver.move(Driver::RIGHT, volt);
-        else if (err > 0) Globals::driver.move(Driver::LEFT, volt);
-        else {
-            Globals::driver.move(Driver::FORWARD, volt);
-            // Check for cross section here instead of inside while condition
-            // Only possible when err = 0
-            crossSection = Globals::line.isCrossSection();
+static void finishCourse() {
+    zone = END;
+}
+
+/*
+ * Transitions of distance measuring.
+ * This part only contains a straight line to be followed; with two TRUE nodes in between.
+ * Each node has a marking at both edges, and each marking is counted exactly once.
+ * So nodeCount will be 2 after crossing one node. When bot reaches the second node, nodeCount will be 3.
+ */
+const StateMachine::Transition DISTANCE_TABLE[DISTANCE_STATES][DISTANCE_EVENTS] PROGMEM = {
+    // NONE, DONE, MARKING, FIRST_MARKING, LAST_MARKING, FINISH_LINE
+    /* MEASURE */ {{SAME, steer}, STAY, {SAME, countMarking}, {SAME, startMeasuring}, {TO_FINISH, showDistance}, STAY},
+    /* TO_FINISH */ {{SAME, steer}, STAY, STAY, STAY, STAY, {FINISHED, showFinish}},
+    /* FINISHED */ {STAY, {SAME, finishCourse}, STAY, STAY, STAY, STAY}
+};
+
+// Machines of the zones; numbered by zone in the transition log
+static StateMachine mazeMachine(MAZE, MAZE_TABLE[0], MAZE_EVENTS);
+static StateMachine wallMachine(WALL, WALL_TABLE[0], WALL_EVENTS);
+static StateMachine distanceMachine(DISTANCE, DISTANCE_TABLE[0], DISTANCE_EVENTS);
+
+/**
+ * Checks for a turn of the line that stayed under the array for TURN_CONFIRM during line following.
+ * Called on every run of the maze, so that any other state starts the wait over.
+ *
+ * @return true once the turn is confirmed
+ */
+static bool confirmTurn() {
+    if (mazeMachine.getState() != FOLLOW_LINE || !Globals::line.is90Turn()) {
+        turnSeen = false;
+        return false;
+    }
+    if (!turnSeen) {
+        turnSeen = true;
+        turnSince = millis();
+    }
+    return millis() - turnSince >= TURN_CONFIRM;
+}
+
+// Event of the maze
+static byte senseMaze() {
+    bool turn = confirmTurn();
+    switch (mazeMachine.getState()) {
+    case FOLLOW_LINE:
+        volt = PROFILED(CALC_VOLT, Globals::line.calcVolt(lineErr));
+        // Walls only matter at the end of the section, so the sensors are idle until the first node
+        if (nodeCount > 0) {
+            Globals::wall.request(WallDetector::LEFT, WALL_AGE);
+            Globals::wall.request(WallDetector::RIGHT, WALL_AGE);
         }
-    } while (!crossSection);
-    Globals::driver.stop();
+        // Node markings don't always read zero deviation
+        if (events & LineArray::NODE_ENTERED) return NODE;
+        // At least one node is present; look for the wall at the end
+        if (events & LineArray::CROSS_ENTERED) return (nodeCount > 0) ? WALLS_AHEAD : CROSS_SECTION;
+        // Only a turn of the line is rotated for; any other deviation is steered out while moving
+        if (lineErr < 0) return turn ? RIGHT_TURN : LEFT_OF_LINE;
+        if (lineErr > 0) return turn ? LEFT_TURN : RIGHT_OF_LINE;
+        if (Globals::line.isOffLine()) return OFF_LINE;
+        if (Globals::line.is120Junction()) return JUNCTION_120;
+        return STRAIGHT;
+
+    case NODE_MARKING:
+    case NODE_BODY:
+        return (events & LineArray::NODE_EXITED) ? DONE : NONE;
+
+    case CROSSING:
+        return (onCrossSection || Globals::line.is120Junction()) ? NONE : DONE;
+
+    case TURNING:
+        return Globals::driver.busy() ? NONE : DONE;
+
+    case TURNING_BACK:
+        if (!Globals::line.isOffLine()) return LINE_FOUND;
+        return Globals::driver.busy() ? NONE : DONE;
+
+    case CHECK_WALLS: {
+        // Left wall first, then right wall; both are ranged together
+        int8_t left = checkWall(WallDetector::LEFT, WALL_AGE);
+        if (left < 0) return NONE;
+        int8_t right = left ? 0 : checkWall(WallDetector::RIGHT, WALL_AGE);
+        if (right < 0) return NONE;
+        if (!left && !right) return NO_WALL;
+        wallSide = left ? WallDetector::LEFT : WallDetector::RIGHT;
+        return DONE;
+    }
+    }
+    return NONE;
+}
+
+// Event of wall following
+static byte senseWall() {
+    int err;
+    // Side opposite to the primary wall
+    byte side = (primaryWall == WallDetector::LEFT) ? WallDetector::RIGHT : WallDetector::LEFT;
 
-    // Print finish
-    Globals::lcd.setCursor(0,1);
-    Globals::lcd.print("FINISH");
+    switch (wallMachine.getState()) {
+    case PRIME:
+        // Wait for the first reading, so that the wall isn't taken as lost before it's measured
+        return (checkWall(primaryWall, WallDetector::MAX_AGE) >= 0) ? DONE : NONE;
+
+    case FOLLOW_WALL:
+        // The opposite wall is ranged together with the primary one, so it's fresh when the primary wall ends
+        Globals::wall.request(side, WallDetector::MAX_AGE);
+        err = PROFILED(WALL_DETECT, Globals::wall.detect(primaryWall));
+        volt = PROFILED(CALC_VOLT, Globals::wall.calcVolt(err));
+        if (err == Globals::wall.MAX_DIST) return WALL_ENDS;
+        if (volt == -1) return FRONT_WALL;
+        if (err < 0) return LEFT_OF_CENTER;
+        if (err > 0) return RIGHT_OF_CENTER;
+        return CENTERED;
+
+    case WALL_LOST: {
+        // Check for wall on opposite side, then for the line
+        int8_t found = checkWall(side, WallDetector::MAX_AGE);
+        if (found < 0) return NONE;
+        if (found) return OTHER_WALL;
+        if (onCrossSection) return LINE_AHEAD;
+        return CORNER;
+    }
+
+    case ALIGN:
+    case TURN_SIDE:
+    case TURN_FRONT:
+        return Globals::driver.busy() ? NONE : DONE;
+
+    case SEEK:
+        // Readings are refreshed in the background; poll without waiting
+        return (PROFILED(WALL_DETECT, Globals::wall.detect(primaryWall)) < Globals::wall.MAX_DIST) ? DONE : NONE;
+    }
+    return NONE;
+}
+
+// Event of distance measuring
+static byte senseDistance() {
+    switch (distanceMachine.getState()) {
+    case MEASURE:
+        volt = PROFILED(CALC_VOLT, Globals::line.calcVolt(lineErr));
+        // Check for node marking
+        if (!(events & LineArray::NODE_ENTERED)) return NONE;
+        if (nodeCount == 0) return FIRST_MARKING;
+        return (nodeCount == 2) ? LAST_MARKING : MARKING;
+
+    case TO_FINISH:
+        volt = PROFILED(CALC_VOLT, Globals::line.calcVolt(lineErr));
+        if (events & LineArray::CROSS_ENTERED) return FINISH_LINE;
+        return NONE;
+
+    case FINISHED:
+        // The display task pushes the result a cell or two at a time
+        return (distanceMachine.elapsed() >= FINISH_TIME && Globals::lcd.flushed()) ? DONE : NONE;
+    }
+    return NONE;
+}
+
+/**
+ * Starts the maze.
+ *
+ * @param primary Side to be followed
+ * @param junctions Junctions passed before a reset
+ */
+static void startMaze(byte primary, byte junctions) {
+    PROFILE_ZONE(MAZE);
+    zone = MAZE;
+    machine = &mazeMachine;
+    primaryTurn = primary;
+    nodeCount = 0;
+    boost = 0;
+    lastOdometer = 0;
+    junctionTurn = NO_TURN;
+
+    // Distances between junctions are measured with the encoder
+    Globals::driver.initEncoder();
+    Globals::maze.begin(primary, junctions);
+    segmentStart = odometer();
+
+    // Initialize diplay
+    PROFILED(LCD, Globals::lcd.setCursor(0,0));
+    PROFILED(LCD, Globals::lcd.print("Node: "));
+    PROFILED(LCD, Globals::lcd.setCursor(0,1));
+    PROFILED(LCD, Globals::lcd.print("Type: "));
+    machine->enter(FOLLOW_LINE);
+}
+
+// Starts wall following
+static void startWallFollowing(byte primary) {
+    PROFILE_ZONE(WALL);
+    zone = WALL;
+    machine = &wallMachine;
+    primaryWall = primary;
+
+    // The estimator tells heading from offset with the encoder, which allows a faster base voltage
+    Globals::driver.initEncoder();
+    Globals::wall.setOdometer(odometer);
+    savedBaseVolt = Globals::driver.getBaseVolt();
+    Globals::driver.setBaseVolt(WALL_BASE_VOLT);
+    machine->enter(PRIME);
+}
+
+// Starts distance measuring
+static void startDistanceMeasuring() {
+    PROFILE_ZONE(DISTANCE);
+    zone = DISTANCE;
+    machine = &distanceMachine;
+    nodeCount = 0;
+    machine->enter(MEASURE);
+}
+
+/*
+ * Progress through the course, saved in EEPROM whenever it changes, so that a reset in the middle of the course
+ * (a brown-out when the motors start) resumes it. The running flag is set from the start to the finish,
+ * whatever the cause of the reset; the bootloader may clear the reset flags of the MCU.
+ * Motions in progress are lost in a reset, so the maze resumes with line following and wall following with
+ * the wall reading; only distance measuring resumes in its own state.
+ * The calibration of the line sensors is saved after it at the start, since the bot can't be swept on a resume.
+ */
+struct Progress {
+    byte magic; // CHECKPOINT_MAGIC
+    byte running; // Course in progress; cleared at the finish, and by a reset during the resume
+    byte zone;
+    byte state; // State to resume in
+    byte side; // Primary turn in the maze, primary wall along the walls
+    byte nodes; // Node markings counted in the zone
+    byte junctions; // Junctions passed in the maze
+};
+static Progress saved;
+
+// Queues the progress if it changed; the control task writes it a byte per run
+static void saveProgress() {
+    Progress now;
+    now.magic = CHECKPOINT_MAGIC;
+    now.running = zone != END;
+    now.zone = zone;
+    now.state = 0;
+    now.side = 0;
+    now.nodes = nodeCount;
+    now.junctions = 0;
+    if (zone == MAZE) {
+        now.state = FOLLOW_LINE;
+        now.side = primaryTurn;
+        now.junctions = Globals::maze.getPosition();
+    } else if (zone == WALL) {
+        now.state = PRIME;
+        now.side = primaryWall;
+    } else if (zone == DISTANCE) now.state = distanceMachine.getState();
+    else now.nodes = 0;
+
+    if (!memcmp(&now, &saved, sizeof(now))) return;
+    saved = now;
+    EepromQueue::put(CHECKPOINT_ADDRESS, saved);
+}
+
+// Start the course
+void startCourse(byte primary) {
+    // The calibration is kept for a resume; written before the tasks start, so it may wait for the EEPROM
+    LineArray::Calibration calibration;
+    Globals::line.getCalibration(calibration);
+    EEPROM.put(CHECKPOINT_ADDRESS + sizeof(Progress), calibration);
+
+    lineEvents = 0;
+    startMaze(primary, 0);
+    saveProgress();
+}
+
+// Resume the course
+bool resumeCourse() {
+    Progress p;
+    EEPROM.get(CHECKPOINT_ADDRESS, p);
+    if (p.magic != CHECKPOINT_MAGIC || !p.running || p.zone >= END || p.side > Driver::RIGHT) return false;
+    if (p.zone == DISTANCE && p.state >= DISTANCE_STATES) return false;
+
+    // Deliberate restart: the flag is off while the resume is shown, so a reset meanwhile starts over
+    EEPROM.update(CHECKPOINT_ADDRESS + offsetof(Progress, running), false);
+    Globals::lcd.setCursor(0, 0);
+    Globals::lcd.print("Resuming");
+    Globals::lcd.flush();
+    delay(RESUME_WAIT);
+    Globals::lcd.clear();
+    EEPROM.update(CHECKPOINT_ADDRESS + offsetof(Progress, running), true);
+
+    LineArray::Calibration calibration;
+    EEPROM.get(CHECKPOINT_ADDRESS + sizeof(Progress), calibration);
+    Globals::line.setCalibration(calibration);
+
+    lineEvents = 0;
+    if (p.zone == MAZE) startMaze(p.side, p.junctions);
+    else if (p.zone == WALL) startWallFollowing(p.side);
+    else {
+        startDistanceMeasuring();
+        // The distance covered before the reset is lost; the encoder restarts here
+        if (p.nodes) Globals::driver.initEncoder();
+        machine->enter(p.state);
+    }
+    nodeCount = p.nodes;
+    saved = p;
+    return true;
+}
+
+// Course complete
+bool courseDone() {
+    return zone == END && EepromQueue::flushed();
+}
+
+// Read the line
+void lineTask() {
+    if (zone == END) return;
+    lineErr = PROFILED(LINE_DETECT, Globals::line.detect());
+    uint8_t fired = Globals::line.getEvents();
+    lineEvents |= fired;
+    if (fired & LineArray::CROSS_ENTERED) onCrossSection = true;
+    if (fired & LineArray::CROSS_EXITED) onCrossSection = false;
+}
+
+// Run the current zone
+void controlTask() {
+    // A byte of the checkpoint or the maze log per run; the last ones are written after the finish
+    EepromQueue::update();
+    if (zone == END) return;
+    PROFILE_SCOPE(CYCLE);
+    // Events are taken on every run, so that the ones seen during a rotation are dropped
+    events = lineEvents;
+    lineEvents = 0;
+    // Ends bounded motions
+    PROFILED(DRIVE, Globals::driver.update());
+
+    byte event = NONE;
+    switch (zone) {
+    case MAZE: event = senseMaze(); break;
+    case WALL: event = senseWall(); break;
+    case DISTANCE: event = senseDistance(); break;
+    default: break;
+    }
+    machine->dispatch(event);
+    saveProgress();
+}
+
+// Range the requested walls
+void sonarTask() {
+    PROFILED(WALL_DETECT, Globals::wall.update());
+}
 
-    // TODO  check if necessary
-    delay (1000); // Safeguard measure
+// Push the framebuffer to the display
+void displayTask() {
+    PROFILED(LCD, Globals::lcd.flush(LCD_BUDGET));
 }